@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "diff.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "hash.h"
+
+#define CONTEXT 3
+#define BINARY_PROBE 8000
+#define MIN_COST_LIMIT 4096
+#define HISTOGRAM_MAX_CHAIN 64
+
+typedef struct {
+    const char *p;
+    size_t len;  /* including the newline, if any */
+    uint64_t h;
+} Line;
+
+/* Search state; lines are compared by class id, equal ids meaning equal lines. */
+typedef struct {
+    const uint32_t *a, *b;
+    char *del, *ins;  /* per line of a / b: not part of the common subsequence */
+    long *vf, *vb;    /* furthest reaching paths, indexed by diagonal */
+    long cost_limit;
+    uint32_t *count;  /* per class: occurrences in the a range being indexed */
+    long *head;       /* per class: first such occurrence */
+    long *chain;      /* per line of a: next occurrence of its class */
+} Diff;
+
+
+static Line *split_lines(const char *s, size_t n, long *out_n) {
+    long count = 0;
+    for (size_t i = 0; i < n; i++) count += s[i] == '\n';
+    if (n > 0 && s[n - 1] != '\n') count++;
+
+    Line *lines = malloc((size_t)(count ? count : 1) * sizeof(*lines));
+    if (!lines) return NULL;
+    long k = 0;
+    for (size_t start = 0; start < n;) {
+        const char *nl = memchr(s + start, '\n', n - start);
+        size_t end = nl ? (size_t)(nl - s) + 1 : n;
+        uint64_t h = FNV_OFFSET;
+        for (size_t i = start; i < end; i++) {
+            h ^= (unsigned char)s[i];
+            h *= FNV_PRIME;
+        }
+        lines[k].p = s + start;
+        lines[k].len = end - start;
+        lines[k].h = h;
+        k++;
+        start = end;
+    }
+    *out_n = count;
+    return lines;
+}
+
+static inline int line_eq(const Line *x, const Line *y) {
+    return x->h == y->h && x->len == y->len && memcmp(x->p, y->p, x->len) == 0;
+}
+
+
+/* Numbers distinct lines, so the searches compare integers instead of text. */
+typedef struct {
+    uint32_t *slots;    /* open addressing, class id + 1, 0 = empty */
+    const Line **reps;  /* first line seen of each class */
+    size_t mask;
+    uint32_t n;
+} Classes;
+
+static int classes_init(Classes *c, long nlines) {
+    size_t cap = 16;
+    while (cap < (size_t)nlines * 2) cap <<= 1;
+    c->slots = calloc(cap, sizeof(uint32_t));
+    c->reps = malloc((size_t)(nlines + 1) * sizeof(*c->reps));
+    c->mask = cap - 1;
+    c->n = 0;
+    return c->slots && c->reps ? 0 : -1;
+}
+
+static void classify(Classes *c, const Line *lines, long n, uint32_t *out) {
+    for (long i = 0; i < n; i++) {
+        size_t slot = (size_t)lines[i].h & c->mask;
+        while (c->slots[slot] && !line_eq(c->reps[c->slots[slot] - 1], &lines[i])) slot = (slot + 1) & c->mask;
+        if (!c->slots[slot]) {
+            c->reps[c->n] = &lines[i];
+            c->slots[slot] = ++c->n;
+        }
+        out[i] = c->slots[slot] - 1;
+    }
+}
+
+static void classes_free(Classes *c) {
+    free(c->slots);
+    free(c->reps);
+}
+
+
+/*
+ * Finds the middle snake of the box [left, right) x [top, bottom): runs
+ * the forward and backward searches until they overlap and returns the
+ * snake where they met. Past cost_limit it gives up on an optimal split
+ * and returns the forward path reaching furthest as a zero-length snake,
+ * which keeps huge, unrelated inputs from going quadratic. Returns 1 in
+ * that case.
+ */
+static int middle_snake(Diff *m, long left, long top, long right, long bottom,
+                        long *sx, long *sy, long *ex, long *ey) {
+    const uint32_t *a = m->a, *b = m->b;
+    long delta = (right - left) - (bottom - top);
+    long max = ((right - left) + (bottom - top) + 1) / 2;
+    long *vf = m->vf, *vb = m->vb;
+    vf[1] = left;
+    vb[1] = bottom;
+
+    vf[-1] = LONG_MIN / 2;
+    vb[-1] = LONG_MAX / 2;
+
+    for (long d = 0; d <= max; d++) {
+        /*
+         * Sentinels past both ends let every diagonal take the better of its
+         * neighbours without a branch: x = max(vf[k - 1] + 1, vf[k + 1]).
+         */
+        if (d > 0) {
+            vf[d + 1] = vf[-d - 1] = LONG_MIN / 2;
+            vb[d + 1] = vb[-d - 1] = LONG_MAX / 2;
+        }
+        for (long k = d; k >= -d; k -= 2) {
+            long right_x = vf[k - 1] + 1, down_x = vf[k + 1];
+            long x0 = right_x > down_x ? right_x : down_x;
+            long x = x0;
+            long y = top + (x - left) - k;
+            while (x < right && y < bottom && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            vf[k] = x;
+            long c = k - delta;
+            if ((delta & 1) && c >= -(d - 1) && c <= d - 1 && y >= vb[c]) {
+                long y0 = top + (x0 - left) - k;
+                int down = d == 0 || down_x >= right_x;
+                *sx = down ? x0 : x0 - 1;
+                *sy = down && d > 0 ? y0 - 1 : y0;
+                *ex = x;
+                *ey = y;
+                return 0;
+            }
+        }
+
+        for (long c = d; c >= -d; c -= 2) {
+            long left_y = vb[c - 1] - 1, up_y = vb[c + 1];
+            long y0 = left_y < up_y ? left_y : up_y;
+            long y = y0;
+            long k = c + delta;
+            long x = left + (y - top) + k;
+            while (x > left && y > top && a[x - 1] == b[y - 1]) {
+                x--;
+                y--;
+            }
+            vb[c] = y;
+            if (!(delta & 1) && k >= -d && k <= d && x <= vf[k]) {
+                long x0 = left + (y0 - top) + k;
+                int up = d == 0 || up_y <= left_y;
+                *sx = x;
+                *sy = y;
+                *ex = up && d > 0 ? x0 + 1 : x0;
+                *ey = up ? y0 : y0 + 1;
+                return 0;
+            }
+        }
+
+        if (d >= m->cost_limit) {
+            long best = -1;
+            for (long k = d; k >= -d; k -= 2) {
+                long x = vf[k] < right ? vf[k] : right;
+                long y = top + (x - left) - k;
+                if (y > bottom) {
+                    y = bottom;
+                    x = left + (y - top) + k;
+                }
+                if (x < left || y < top) continue;
+                if (x + y > best) {
+                    best = x + y;
+                    *sx = *ex = x;
+                    *sy = *ey = y;
+                }
+            }
+            return 1;
+        }
+    }
+    return -1;
+}
+
+static void mark_all(Diff *m, long left, long top, long right, long bottom) {
+    for (long x = left; x < right; x++) m->del[x] = 1;
+    for (long y = top; y < bottom; y++) m->ins[y] = 1;
+}
+
+/* Drops the common prefix and suffix of a range; returns 1 when nothing is left to search. */
+static int trim(Diff *m, long *left, long *top, long *right, long *bottom) {
+    while (*left < *right && *top < *bottom && m->a[*left] == m->b[*top]) {
+        (*left)++;
+        (*top)++;
+    }
+    while (*left < *right && *top < *bottom && m->a[*right - 1] == m->b[*bottom - 1]) {
+        (*right)--;
+        (*bottom)--;
+    }
+    if (*left == *right || *top == *bottom) {
+        mark_all(m, *left, *top, *right, *bottom);
+        return 1;
+    }
+    return 0;
+}
+
+static void compare(Diff *m, long left, long top, long right, long bottom) {
+    if (trim(m, &left, &top, &right, &bottom)) return;
+
+    long sx = left, sy = top, ex = left, ey = top;
+    int rc = middle_snake(m, left, top, right, bottom, &sx, &sy, &ex, &ey);
+    if (rc < 0 || (sx == left && sy == top && ex == right && ey == bottom) ||
+        (rc == 1 && ((sx == left && sy == top) || (sx == right && sy == bottom)))) {
+        mark_all(m, left, top, right, bottom);
+        return;
+    }
+    compare(m, left, top, sx, sy);
+    compare(m, sx, sy, ex, ey);
+    compare(m, ex, ey, right, bottom);
+}
+
+
+/*
+ * Looks for the anchor of a histogram split: among the lines of the range
+ * in b that occur at most HISTOGRAM_MAX_CHAIN times in the range of a,
+ * the run of common lines around the rarest one, longer runs winning ties.
+ * Returns -1 when there is none.
+ */
+static int find_anchor(Diff *m, long left, long top, long right, long bottom,
+                       long *as_out, long *bs_out, long *ae_out, long *be_out) {
+    const uint32_t *a = m->a, *b = m->b;
+    uint32_t *count = m->count;
+    for (long x = right - 1; x >= left; x--) {
+        uint32_t c = a[x];
+        m->chain[x] = count[c] ? m->head[c] : -1;
+        m->head[c] = x;
+        count[c]++;
+    }
+
+    uint32_t best_count = HISTOGRAM_MAX_CHAIN + 1;
+    long best_len = 0;
+    for (long y = top; y < bottom;) {
+        uint32_t c = b[y];
+        long next_y = y + 1;
+        if (count[c] == 0 || count[c] > best_count) {
+            y = next_y;
+            continue;
+        }
+        for (long x = m->head[c]; x >= 0;) {
+            long as = x, bs = y, ae = x + 1, be = y + 1;
+            uint32_t rc = count[c];
+            while (as > left && bs > top && a[as - 1] == b[bs - 1]) {
+                as--;
+                bs--;
+                if (count[a[as]] < rc) rc = count[a[as]];
+            }
+            while (ae < right && be < bottom && a[ae] == b[be]) {
+                if (count[a[ae]] < rc) rc = count[a[ae]];
+                ae++;
+                be++;
+            }
+            if (be > next_y) next_y = be;
+            if (ae - as > best_len || rc < best_count) {
+                best_len = ae - as;
+                best_count = rc;
+                *as_out = as;
+                *bs_out = bs;
+                *ae_out = ae;
+                *be_out = be;
+            }
+            /* Occurrences inside this run would only find it again. */
+            long nx = m->chain[x];
+            while (nx >= 0 && nx < ae) nx = m->chain[nx];
+            x = nx;
+        }
+        y = next_y;
+    }
+
+    for (long x = left; x < right; x++) count[a[x]] = 0;
+    return best_len > 0 ? 0 : -1;
+}
+
+/*
+ * Histogram diff, as in git: splits the range at the anchor from
+ * find_anchor and repeats on both sides, which keeps rare lines such as
+ * function headers aligned and is fast on typical edits. Ranges without
+ * an anchor go to Myers. The smaller side is handled by recursion and the
+ * larger one by the loop, so the depth stays logarithmic.
+ */
+static void histogram(Diff *m, long left, long top, long right, long bottom) {
+    for (;;) {
+        if (trim(m, &left, &top, &right, &bottom)) return;
+        long as = 0, bs = 0, ae = 0, be = 0;
+        if (find_anchor(m, left, top, right, bottom, &as, &bs, &ae, &be) != 0) {
+            compare(m, left, top, right, bottom);
+            return;
+        }
+        if ((as - left) + (bs - top) < (right - ae) + (bottom - be)) {
+            histogram(m, left, top, as, bs);
+            left = ae;
+            top = be;
+        } else {
+            histogram(m, ae, be, right, bottom);
+            right = as;
+            bottom = bs;
+        }
+    }
+}
+
+
+/*
+ * Moves the lines of src whose class never occurs on the other side out
+ * of the way: they cannot be part of a common subsequence, so they are
+ * marked changed up front and the search runs on the remaining ones.
+ * map[i] is the original index of kept line i.
+ */
+static long keep_shared(const uint32_t *src, long n, const char *other, char *changed, uint32_t *kept, long *map) {
+    long k = 0;
+    for (long i = 0; i < n; i++) {
+        if (other[src[i]]) {
+            kept[k] = src[i];
+            map[k++] = i;
+        } else {
+            changed[i] = 1;
+        }
+    }
+    return k;
+}
+
+
+static void print_range(FILE *out, long start, long count) {
+    if (count == 1) fprintf(out, "%ld", start + 1);
+    else fprintf(out, "%ld,%ld", count ? start + 1 : start, count);
+}
+
+static void print_line(FILE *out, char prefix, const Line *l) {
+    fputc(prefix, out);
+    fwrite(l->p, 1, l->len, out);
+    if (l->len == 0 || l->p[l->len - 1] != '\n') fputs("\n\\ No newline at end of file\n", out);
+}
+
+static void print_hunks(FILE *out, const Line *la, const Line *lb, const char *del, const char *ins, long na, long nb) {
+    long i = 0, j = 0;
+    for (;;) {
+        while (i < na && j < nb && !del[i] && !ins[j]) {
+            i++;
+            j++;
+        }
+        if (i >= na && j >= nb) break;
+
+        long ctx = i < CONTEXT ? i : CONTEXT;
+        long ha = i - ctx, hb = j - ctx;
+
+        /* Extend the hunk until CONTEXT lines on both sides of a gap no longer touch. */
+        long ei = i, ej = j;
+        for (;;) {
+            while ((ei < na && del[ei]) || (ej < nb && ins[ej])) {
+                if (ei < na && del[ei]) ei++;
+                else ej++;
+            }
+            long run = 0;
+            while (ei + run < na && ej + run < nb && !del[ei + run] && !ins[ej + run]) run++;
+            if (ei + run >= na && ej + run >= nb) {
+                long tail = run < CONTEXT ? run : CONTEXT;
+                ei += tail;
+                ej += tail;
+                break;
+            }
+            if (run > 2 * CONTEXT) {
+                ei += CONTEXT;
+                ej += CONTEXT;
+                break;
+            }
+            ei += run;
+            ej += run;
+        }
+
+        fputs("@@ -", out);
+        print_range(out, ha, ei - ha);
+        fputs(" +", out);
+        print_range(out, hb, ej - hb);
+        fputs(" @@\n", out);
+
+        long x = ha, y = hb;
+        while (x < ei || y < ej) {
+            if (x < ei && del[x]) {
+                print_line(out, '-', &la[x++]);
+            } else if (y < ej && ins[y]) {
+                print_line(out, '+', &lb[y++]);
+            } else {
+                print_line(out, ' ', &la[x]);
+                x++;
+                y++;
+            }
+        }
+        i = ei;
+        j = ej;
+    }
+}
+
+
+static int looks_binary(const char *s, size_t n) {
+    return memchr(s, '\0', n < BINARY_PROBE ? n : BINARY_PROBE) != NULL;
+}
+
+int diff_text(FILE *out, const char *label_a, const char *label_b,
+              const char *a, size_t alen, const char *b, size_t blen) {
+    if (alen == blen && memcmp(a, b, alen) == 0) return 0;
+    if (looks_binary(a, alen) || looks_binary(b, blen)) {
+        fprintf(out, "Binary files %s and %s differ\n", label_a, label_b);
+        return 0;
+    }
+
+    long na = 0, nb = 0;
+    Line *la = split_lines(a, alen, &na);
+    Line *lb = split_lines(b, blen, &nb);
+    uint32_t *ca = malloc((size_t)(na + 1) * sizeof(uint32_t));
+    uint32_t *cb = malloc((size_t)(nb + 1) * sizeof(uint32_t));
+    uint32_t *ka = malloc((size_t)(na + 1) * sizeof(uint32_t));
+    uint32_t *kb = malloc((size_t)(nb + 1) * sizeof(uint32_t));
+    long *mapa = malloc((size_t)(na + 1) * sizeof(long));
+    long *mapb = malloc((size_t)(nb + 1) * sizeof(long));
+    char *del = calloc((size_t)na + 1, 1);
+    char *ins = calloc((size_t)nb + 1, 1);
+    long span = na + nb + 2;
+    long *vf = malloc((size_t)(2 * span + 1) * sizeof(long));
+    long *vb = malloc((size_t)(2 * span + 1) * sizeof(long));
+    char *in_a = NULL, *in_b = NULL;
+    Classes classes;
+    memset(&classes, 0, sizeof(classes));
+    Diff m;
+    memset(&m, 0, sizeof(m));
+    int rc = -1;
+    if (!la || !lb || !ca || !cb || !ka || !kb || !mapa || !mapb || !del || !ins || !vf || !vb) goto out;
+    if (classes_init(&classes, na + nb) != 0) goto out;
+    classify(&classes, la, na, ca);
+    classify(&classes, lb, nb, cb);
+
+    size_t nclass = (size_t)classes.n + 1;
+    in_a = calloc(nclass, 1);
+    in_b = calloc(nclass, 1);
+    m.count = calloc(nclass, sizeof(uint32_t));
+    m.head = malloc(nclass * sizeof(long));
+    m.chain = malloc((size_t)(na + 1) * sizeof(long));
+    if (!in_a || !in_b || !m.count || !m.head || !m.chain) goto out;
+    for (long i = 0; i < na; i++) in_a[ca[i]] = 1;
+    for (long j = 0; j < nb; j++) in_b[cb[j]] = 1;
+
+    long nka = keep_shared(ca, na, in_b, del, ka, mapa);
+    long nkb = keep_shared(cb, nb, in_a, ins, kb, mapb);
+    m.a = ka;
+    m.b = kb;
+    m.del = calloc((size_t)nka + 1, 1);
+    m.ins = calloc((size_t)nkb + 1, 1);
+    if (!m.del || !m.ins) goto out;
+    m.vf = vf + span;
+    m.vb = vb + span;
+
+    /* Roughly the square root of the input, as GNU diff does. */
+    m.cost_limit = 1;
+    for (long n = nka + nkb; n != 0; n >>= 2) m.cost_limit <<= 1;
+    if (m.cost_limit < MIN_COST_LIMIT) m.cost_limit = MIN_COST_LIMIT;
+
+    histogram(&m, 0, 0, nka, nkb);
+    for (long i = 0; i < nka; i++) del[mapa[i]] |= m.del[i];
+    for (long j = 0; j < nkb; j++) ins[mapb[j]] |= m.ins[j];
+
+    fprintf(out, "--- %s\n+++ %s\n", label_a, label_b);
+    print_hunks(out, la, lb, del, ins, na, nb);
+    rc = 0;
+
+out:
+    classes_free(&classes);
+    free(la);
+    free(lb);
+    free(ca);
+    free(cb);
+    free(ka);
+    free(kb);
+    free(mapa);
+    free(mapb);
+    free(del);
+    free(ins);
+    free(in_a);
+    free(in_b);
+    free(m.del);
+    free(m.ins);
+    free(m.count);
+    free(m.head);
+    free(m.chain);
+    free(vf);
+    free(vb);
+    return rc;
+}
@@ -0,0 +1,15 @@
+#ifndef FDIFF_DIFF_H
+#define FDIFF_DIFF_H
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Writes a unified line diff (three lines of context) of a against b to
+ * out. A histogram pass anchors on rare common lines; what it cannot split
+ * goes to Myers' linear space algorithm. Inputs with a NUL byte near the
+ * start are reported as binary. Returns -1 on allocation failure.
+ */
+int diff_text(FILE *out, const char *label_a, const char *label_b,
+              const char *a, size_t alen, const char *b, size_t blen);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,23 +6,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <signal.h>
+#include <time.h>
 #include <inttypes.h>
 #include <bsd/string.h>
 #include <bsd/err.h>      /* err, errx, errc, verr, verrx, verrc */
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
+#include "hash.h"
 #include "ignore.h"
+#include "libfdiff.h"
+#include "pool.h"
 #include "store.h"
+#include "walk.h"
 
-#define INDEX_DIR ".fdiff"
-#define INDEX_FILE ".fdiff/index.bin"
-#define IGNORE_FILE ".fdiffignore"
+#define INDEX_DIR FDIFF_DIR
+#define INDEX_FILE FDIFF_INDEX_FILE
+#define IGNORE_FILE FDIFF_IGNORE_FILE
+#define OBJECTS_DIR FDIFF_DIR "/objects"
+#define VERIFY_CURSOR_FILE ".fdiff/verify.cursor"
+
+#define BATCH_MAX_THREADS 32
 
 #define EXIT_OK 0
 #define EXIT_FAIL 1
@@ -30,494 +43,719 @@
 #define EXIT_ALREADY_INITIALIZED 5
 #define EXIT_ALREADY_ADDED 6
 #define EXIT_DIFF_FOUND 7
+#define EXIT_INTERRUPTED 8
 
-
-static size_t next_capacity(size_t cur) {
-    if (cur == 0) return 256;
-    return cur * 2;
+static void on_interrupt(int sig) {
+    (void)sig;
+    fdiff_set_interrupted(1);
 }
 
-static int compute_file_hash(const char *path, uint64_t *out_hash, uint64_t *out_size) {
-    int fd = open(path, O_RDONLY | O_CLOEXEC);
-    if (fd < 0) return -1;
+
+static int cmd_init(int argc, char *argv[]) {
+    bool snapshots = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--snapshots") == 0) {
+            snapshots = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAIL;
+        }
+    }
 
     struct stat st;
-    if (fstat(fd, &st) < 0) {
-        close(fd);
-        return -1;
+    if (stat(INDEX_DIR, &st) == 0 && S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Already initialized.\n");
+        return EXIT_ALREADY_INITIALIZED;
     }
-    if (!S_ISREG(st.st_mode)) {
-        close(fd);
-        return -1;
+    if (mkdir(INDEX_DIR, 0755) < 0) {
+        err(EXIT_FAIL, "mkdir");
     }
-
-    if (st.st_size == 0) {
-        *out_hash = 0;
-        if (out_size) *out_size = 0;
-        close(fd);
-        return 0;
+    if (snapshots && mkdir(OBJECTS_DIR, 0755) < 0) {
+        err(EXIT_FAIL, "mkdir");
     }
 
-    const uint64_t FNV_OFFSET = 14695981039346656037ULL;
-    const uint64_t FNV_PRIME  = 1099511628211ULL;
-    uint64_t h = FNV_OFFSET;
-
-    const size_t BUF_SZ = 1024;
-    unsigned char *buf = malloc(BUF_SZ);
-    if (!buf) {
-        close(fd);
-        return -1;
+    
+    RecordSet empty;
+    recset_init(&empty);
+    if (store_save(INDEX_FILE, &empty) != 0) {
+        errx(EXIT_FAIL, "Failed to create index file");
     }
 
-    ssize_t r;
-    while ((r = read(fd, buf, BUF_SZ)) > 0) {
-        for (ssize_t i = 0; i < r; i++) {
-            h ^= (uint64_t)buf[i];
-            h *= FNV_PRIME;
+    
+    FILE *f = fopen(IGNORE_FILE, "r");
+    if (!f) {
+        f = fopen(IGNORE_FILE, "w");
+        if (!f) {
+            perror("fopen");
+            return EXIT_FAIL;
         }
+        fprintf(f, ".fdiff\n");
+        fclose(f);
+    } else {
+        fclose(f);
+    }
+
+    printf("Initialized empty fdiff\n");
+    return EXIT_OK;
+}
+
+
+static int cmd_add(int argc, char *argv[]) {
+    fdiff_repo *repo;
+    if (fdiff_open(".", &repo) != FDIFF_OK) {
+        if (errno == ENOENT) fprintf(stderr, "Not initialized.\n");
+        else perror("fdiff");
+        return EXIT_FAIL;
     }
-    free(buf);
-    if (r < 0) {
-        close(fd);
-        return -1;
+
+    struct sigaction sa, old_int, old_term;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_interrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    int ret = fdiff_add(repo, (const char *const *)(argv + 2), (size_t)(argc - 2));
+    if (fdiff_error(repo)[0] != '\0') {
+        fprintf(stderr, "%s\n", fdiff_error(repo));
+    } else if (ret == EXIT_INTERRUPTED) {
+        fprintf(stderr, "Interrupted; progress saved, rerun add to resume.\n");
     }
 
-    *out_hash = h;
-    if (out_size) *out_size = (uint64_t)st.st_size;
-    close(fd);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    fdiff_close(repo);
+    return ret;
+}
+
+
+/*
+ * Batch status over many roots in one process: a pool of threads takes
+ * the next root, runs status on its own repo handle into a buffer, and
+ * the main thread prints each root's lines, tagged with the root, in the
+ * order the roots were given.
+ */
+typedef struct {
+    const char *root;
+    char *text;
+    size_t text_len;
+    int ret;
+} RootJob;
+
+typedef struct {
+    RootJob *jobs;
+    const char *const *paths;
+    size_t npaths;
+    int quick;
+    int ret;
+} RootBatch;
+
+typedef struct {
+    FILE *out;
+    const char *root;
+} RootOutput;
+
+static const char *const change_labels[] = {
+    [FDIFF_UNTRACKED] = "Untracked",
+    [FDIFF_MODIFIED] = "Modified",
+    [FDIFF_DELETED] = "Deleted",
+};
+
+static int print_change(fdiff_change kind, const char *path, void *arg) {
+    (void)arg;
+    printf("%s: %s\n", change_labels[kind], path);
     return 0;
 }
 
+static int print_root_change(fdiff_change kind, const char *path, void *arg) {
+    RootOutput *o = arg;
+    fprintf(o->out, "%s\t%s: %s\n", o->root, change_labels[kind], path);
+    return 0;
+}
 
-static char *normalize_relpath(const char *p) {
-    if (!p) return NULL;
-    
-    size_t L = strlen(p);
-    char *buf = malloc(L + 2);
-    if (!buf) return NULL;
-    strlcpy(buf, p, L+2);
-    
-    if (buf[0] == '.' && buf[1] == '/') {
-        memmove(buf, buf + 2, strlen(buf + 2) + 1);
+static void status_root(void *arg, size_t i) {
+    RootBatch *batch = arg;
+    RootJob *job = &batch->jobs[i];
+    RootOutput o = { open_memstream(&job->text, &job->text_len), job->root };
+    if (!o.out) {
+        job->ret = EXIT_FAIL;
+        return;
     }
-    
-    if (strlen(buf) > 1 && buf[strlen(buf)-1] == '/') {
-        buf[strlen(buf)-1] = '\0';
+    fdiff_repo *repo;
+    if (fdiff_open(job->root, &repo) != FDIFF_OK) {
+        char buf[256];
+        const char *msg = errno == ENOENT ? "Not initialized." : strerror_r(errno, buf, sizeof(buf));
+        fprintf(o.out, "%s\terror: %s\n", job->root, msg);
+        job->ret = EXIT_FAIL;
+    } else {
+        fdiff_set_quick(repo, batch->quick);
+        job->ret = fdiff_status_paths(repo, batch->paths, batch->npaths, print_root_change, &o);
+        if (job->ret == FDIFF_FAIL) fprintf(o.out, "%s\terror: %s\n", job->root, fdiff_error(repo));
+        fdiff_close(repo);
     }
-    return buf;
+    fprintf(o.out, "%s\texit %d\n", job->root, job->ret);
+    if (fclose(o.out) != 0) job->ret = EXIT_FAIL;
 }
 
+/* Any failure wins over differences, which win over clean roots. */
+static void emit_root(void *arg, size_t i) {
+    RootBatch *batch = arg;
+    RootJob *job = &batch->jobs[i];
+    if (job->text) fwrite(job->text, 1, job->text_len, stdout);
+    free(job->text);
+    if (job->ret == EXIT_FAIL) batch->ret = EXIT_FAIL;
+    else if (job->ret == EXIT_DIFF_FOUND && batch->ret == EXIT_OK) batch->ret = EXIT_DIFF_FOUND;
+}
 
-static int collect_files(char **start_paths, int nstart, const IgnoreList *ignore, FileRecord **out_list, size_t *out_count) {
-    FileRecord *list = NULL;
-    size_t count = 0, cap = 0;
+static int status_roots(char **roots, size_t nroots, const char *const *paths, size_t npaths, int quick) {
+    RootBatch batch;
+    batch.jobs = calloc(nroots, sizeof(RootJob));
+    if (!batch.jobs) err(EXIT_FAIL, "calloc");
+    for (size_t i = 0; i < nroots; i++) batch.jobs[i].root = roots[i];
+    batch.paths = paths;
+    batch.npaths = npaths;
+    batch.quick = quick;
+    batch.ret = EXIT_OK;
+
+    pool_run_ordered(nroots, BATCH_MAX_THREADS, status_root, emit_root, &batch);
+    free(batch.jobs);
+    return batch.ret;
+}
 
-    
-    char **stack = NULL;
-    size_t stack_count = 0, stack_cap = 0;
-
-    for (int i = 0; i < nstart; i++) {
-        char *norm = normalize_relpath(start_paths[i]);
-        if (!norm) goto err;
-        struct stat st;
-        if (lstat(start_paths[i], &st) < 0) {
-            
-            free(norm);
-            continue;
-        }
-        if (S_ISDIR(st.st_mode)) {
-            
-            int is_ig = ignore_match(ignore, norm, 1);
-            if (!is_ig) {
-                
-                if (stack_count + 1 > stack_cap) {
-                    size_t nc = next_capacity(stack_cap);
-                    char **tmp = realloc(stack, nc * sizeof(char *));
-                    if (!tmp) { free(norm); goto err; }
-                    stack = tmp; stack_cap = nc;
-                }
-                stack[stack_count++] = norm;
-            } else {
-                free(norm);
-            }
-        } else if (S_ISREG(st.st_mode)) {
-            int is_ig = ignore_match(ignore, norm, 0);
-            if (!is_ig) {
-                if (count + 1 > cap) {
-                    size_t nc = next_capacity(cap);
-                    FileRecord *tmp = realloc(list, nc * sizeof(FileRecord));
-                    if (!tmp) { free(norm); goto err; }
-                    list = tmp; cap = nc;
-                }
-                list[count].path = norm;
-                list[count].hash = 0; 
-                list[count].size = (uint64_t)st.st_size;
-                list[count].mtime = (uint64_t)st.st_mtime;
-                list[count].dev = (uint64_t)st.st_dev;
-                list[count].ino = (uint64_t)st.st_ino;
-                count++;
-            } else {
-                free(norm);
+static void push_root(char ***roots, size_t *nroots, size_t *cap, const char *root) {
+    if (*nroots == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        char **grown = realloc(*roots, *cap * sizeof(char *));
+        if (!grown) err(EXIT_FAIL, "realloc");
+        *roots = grown;
+    }
+    (*roots)[*nroots] = strdup(root);
+    if (!(*roots)[*nroots]) err(EXIT_FAIL, "strdup");
+    (*nroots)++;
+}
+
+/* Appends the roots listed in path, one per line; blank lines and '#' comments are skipped. */
+static int read_roots_file(const char *path, char ***roots, size_t *nroots, size_t *cap) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) return -1;
+    char line[PATH_MAX + 2];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        push_root(roots, nroots, cap, line);
+    }
+    if (f != stdin) fclose(f);
+    return 0;
+}
+
+static int cmd_status(int argc, char *argv[]) {
+    char **roots = NULL;
+    size_t nroots = 0, roots_cap = 0;
+    bool batch = false;
+    bool quick = false;
+    const char **paths = calloc((size_t)argc, sizeof(char *));
+    size_t npaths = 0;
+    if (!paths) err(EXIT_FAIL, "calloc");
+
+    /* A typo must not turn into a pathspec and report a clean tree. */
+    int ret = EXIT_OK;
+    bool options = true;
+    for (int i = 2; i < argc; i++) {
+        const char *opt = argv[i];
+        if (!options || opt[0] != '-' || opt[1] == '\0') {
+            paths[npaths++] = opt;
+        } else if (strcmp(opt, "--") == 0) {
+            options = false;
+        } else if (strcmp(opt, "--quick") == 0) {
+            quick = true;
+        } else if ((strcmp(opt, "--roots") == 0 || strcmp(opt, "-C") == 0) && i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", opt);
+            ret = EXIT_FAIL;
+            goto out;
+        } else if (strcmp(opt, "--roots") == 0) {
+            batch = true;
+            if (read_roots_file(argv[++i], &roots, &nroots, &roots_cap) != 0) {
+                err(EXIT_FAIL, "%s", argv[i]);
             }
+        } else if (strcmp(opt, "-C") == 0) {
+            batch = true;
+            push_root(&roots, &nroots, &roots_cap, argv[++i]);
         } else {
-            free(norm);
+            fprintf(stderr, "Unknown option: %s\n", opt);
+            ret = EXIT_FAIL;
+            goto out;
         }
     }
 
-    
-    while (stack_count > 0) {
-        char *dirpath = stack[--stack_count];
-        DIR *d = opendir(dirpath);
-        if (!d) {
-            free(dirpath);
-            continue;
+    if (batch) {
+        ret = nroots ? status_roots(roots, nroots, paths, npaths, quick) : EXIT_OK;
+    } else {
+        fdiff_repo *repo;
+        if (fdiff_open(".", &repo) != FDIFF_OK) {
+            if (errno == ENOENT) fprintf(stderr, "Not initialized.\n");
+            else perror("fdiff");
+            ret = EXIT_FAIL;
+            goto out;
         }
-        struct dirent *de;
-        while ((de = readdir(d)) != NULL) {
-            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
-            
-            size_t need = strlen(dirpath) + 1 + strlen(de->d_name) + 1;
-            char *child = malloc(need);
-            if (!child) {
-                closedir(d);
-                free(dirpath);
-                goto err;
-            }
-            child[0] = '\0';
-            strlcpy(child, dirpath, need);
-            
-            if (strcmp(child, ".") == 0) child[0] = '\0';
-            if (child[0] != '\0') {
-                strlcat(child, "/", need);
-            }
-            strlcat(child, de->d_name, need);
+        fdiff_set_quick(repo, quick);
+        ret = fdiff_status_paths(repo, paths, npaths, print_change, NULL);
+        if (ret == FDIFF_FAIL) fprintf(stderr, "%s\n", fdiff_error(repo));
+        fdiff_close(repo);
+    }
 
-            struct stat st;
-            if (lstat(child, &st) < 0) {
-                free(child);
-                continue;
-            }
-            int is_dir = S_ISDIR(st.st_mode);
-            
-            char *rel = normalize_relpath(child);
-            if (!rel) { free(child); closedir(d); goto err; }
-
-            if (ignore_match(ignore, rel, is_dir)) {
-                free(rel);
-                free(child);
-                continue;
-            }
+out:
+    for (size_t i = 0; i < nroots; i++) free(roots[i]);
+    free(roots);
+    free(paths);
+    return ret;
+}
 
-            if (is_dir) {
-                
-                if (stack_count + 1 > stack_cap) {
-                    size_t nc = next_capacity(stack_cap);
-                    char **tmp = realloc(stack, nc * sizeof(char *));
-                    if (!tmp) { free(rel); free(child); closedir(d); goto err; }
-                    stack = tmp; stack_cap = nc;
-                }
-                stack[stack_count++] = child; 
-                free(rel);
-            } else if (S_ISREG(st.st_mode)) {
-                if (count + 1 > cap) {
-                    size_t nc = next_capacity(cap);
-                    FileRecord *tmp = realloc(list, nc * sizeof(FileRecord));
-                    if (!tmp) { free(rel); free(child); closedir(d); goto err; }
-                    list = tmp; cap = nc;
-                }
-                list[count].path = rel; 
-                list[count].hash = 0;
-                list[count].size = (uint64_t)st.st_size;
-                list[count].mtime = (uint64_t)st.st_mtime;
-                list[count].dev = (uint64_t)st.st_dev;
-                list[count].ino = (uint64_t)st.st_ino;
-                count++;
-                free(child);
-            } else {
-                free(rel);
-                free(child);
-            }
-        }
-        closedir(d);
-        free(dirpath);
+
+static int cmd_diff(int argc, char *argv[]) {
+    fdiff_repo *repo;
+    if (fdiff_open(".", &repo) != FDIFF_OK) {
+        if (errno == ENOENT) fprintf(stderr, "Not initialized.\n");
+        else perror("fdiff");
+        return EXIT_FAIL;
     }
 
-    free(stack);
-    *out_list = list;
-    *out_count = count;
-    return 0;
+    int ret = fdiff_diff(repo, (const char *const *)(argv + 2), (size_t)(argc - 2), stdout);
+    if (ret == FDIFF_FAIL) fprintf(stderr, "%s\n", fdiff_error(repo));
+    fdiff_close(repo);
+    return ret;
+}
+
 
-err:
-    for (size_t i = 0; i < count; i++) free(list[i].path);
-    free(list);
-    if (stack) {
-        for (size_t i = 0; i < stack_count; i++) free(stack[i]);
-        free(stack);
+/* Parses a byte count with an optional K/M/G suffix (powers of 1024). */
+static int parse_size(const char *s, uint64_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno != 0 || end == s) return -1;
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    default: break;
     }
-    return -1;
+    if (*end != '\0') return -1;
+    *out = (uint64_t)v;
+    return 0;
 }
 
 
-static int cmp_record_path(const void *a, const void *b) {
-    const FileRecord *ra = a;
-    const FileRecord *rb = b;
-    return strcmp(ra->path, rb->path);
+/* Parses a plain decimal count. */
+static int parse_count(const char *s, uint64_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0') return -1;
+    *out = (uint64_t)v;
+    return 0;
 }
 
-
-static ssize_t find_record_idx(FileRecord *records, size_t count, const char *path) {
-    size_t lo = 0, hi = count;
-    while (lo < hi) {
-        size_t mid = (lo + hi) / 2;
-        int c = strcmp(records[mid].path, path);
-        if (c == 0) return (ssize_t)mid;
-        if (c < 0) lo = mid + 1;
-        else hi = mid;
+/* Parses a duration in seconds with an optional s/m/h suffix. */
+static int parse_duration(const char *s, uint64_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno != 0 || end == s) return -1;
+    switch (*end) {
+    case 's': end++; break;
+    case 'm': v *= 60; end++; break;
+    case 'h': v *= 3600; end++; break;
+    default: break;
     }
-    return -1;
+    if (*end != '\0') return -1;
+    *out = (uint64_t)v;
+    return 0;
 }
 
 
-static int cmd_init(void) {
-    struct stat st;
-    if (stat(INDEX_DIR, &st) == 0 && S_ISDIR(st.st_mode)) {
-        fprintf(stderr, "Already initialized.\n");
-        return EXIT_ALREADY_INITIALIZED;
-    }
-    if (mkdir(INDEX_DIR, 0755) < 0) {
-        err(EXIT_FAIL, "mkdir");
+/* Puts this process in the idle I/O class so a scrub yields to real work. */
+static void set_idle_io_priority(void) {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    const int IOPRIO_WHO_PROCESS = 1;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) {
+        fprintf(stderr, "Warning: failed to set idle I/O priority. Continuing.\n");
     }
+#endif
+}
 
-    
-    if (store_save(INDEX_FILE, NULL, 0) != 0) {
-        errx(EXIT_FAIL, "Failed to create index file");
-    }
 
-    
-    FILE *f = fopen(IGNORE_FILE, "r");
-    if (!f) {
-        f = fopen(IGNORE_FILE, "w");
-        if (!f) {
-            perror("fopen");
-            return EXIT_FAIL;
+/*
+ * The cursor names the last file verified. A run that stops inside a file
+ * names that file instead, followed by a line "offset hash size mtime_ns"
+ * with the bytes hashed so far, so the next run continues mid-file.
+ */
+typedef struct {
+    char path[PATH_MAX];
+    bool partial;
+    uint64_t offset;
+    uint64_t state;
+    uint64_t size;
+    uint64_t mtime_ns;
+} VerifyCursor;
+
+static uint64_t stat_mtime_ns(const struct stat *st) {
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + (uint64_t)st->st_mtim.tv_nsec;
+}
+
+static int verify_cursor_load(VerifyCursor *c) {
+    FILE *f = fopen(VERIFY_CURSOR_FILE, "r");
+    if (!f) return -1;
+    memset(c, 0, sizeof(*c));
+    int rc = -1;
+    char line[PATH_MAX + 2];
+    if (fgets(c->path, sizeof(c->path), f)) {
+        c->path[strcspn(c->path, "\n")] = '\0';
+        rc = 0;
+        if (fgets(line, sizeof(line), f) &&
+            sscanf(line, "%" SCNu64 " %" SCNx64 " %" SCNu64 " %" SCNu64, &c->offset, &c->state, &c->size, &c->mtime_ns) == 4) {
+            c->partial = true;
         }
-        fprintf(f, ".fdiff\n");
-        fclose(f);
-    } else {
-        fclose(f);
     }
+    fclose(f);
+    return rc;
+}
 
-    printf("Initialized empty fdiff\n");
-    return EXIT_OK;
+static int verify_cursor_save(const VerifyCursor *c) {
+    FILE *f = fopen(VERIFY_CURSOR_FILE ".tmp", "w");
+    if (!f) return -1;
+    fprintf(f, "%s\n", c->path);
+    if (c->partial) {
+        fprintf(f, "%" PRIu64 " %016" PRIx64 " %" PRIu64 " %" PRIu64 "\n", c->offset, c->state, c->size, c->mtime_ns);
+    }
+    if (fclose(f) != 0) return -1;
+    return rename(VERIFY_CURSOR_FILE ".tmp", VERIFY_CURSOR_FILE);
 }
 
 
-static int cmd_add(int argc, char *argv[]) {
+/*
+ * Rehashes tracked files and compares them with the index, in path order.
+ * Progress is kept in VERIFY_CURSOR_FILE so a scrub can be spread over
+ * several runs, down to the byte within a file; a run stops at
+ * --time-limit, on a signal, or at the end of the index, which resets the
+ * cursor. A run that cannot advance at all fails, so a window too small
+ * for the next read is noticed.
+ */
+static int cmd_verify(int argc, char *argv[]) {
+    Throttle throttle;
+    memset(&throttle, 0, sizeof(throttle));
+    uint64_t time_limit = 0;
+    bool restart = false;
+
+    for (int i = 2; i < argc; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--restart") == 0) {
+            restart = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", opt);
+            return EXIT_FAIL;
+        }
+        const char *val = argv[++i];
+        int rc;
+        if (strcmp(opt, "--bwlimit") == 0) rc = parse_size(val, &throttle.bytes_per_sec);
+        else if (strcmp(opt, "--iops") == 0) rc = parse_count(val, &throttle.iops);
+        else if (strcmp(opt, "--time-limit") == 0) rc = parse_duration(val, &time_limit);
+        else {
+            fprintf(stderr, "Unknown option: %s\n", opt);
+            return EXIT_FAIL;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "Invalid value for %s: %s\n", opt, val);
+            return EXIT_FAIL;
+        }
+    }
+
     struct stat st;
     if (stat(INDEX_FILE, &st) != 0) {
         fprintf(stderr, "Not initialized.\n");
         return EXIT_FAIL;
     }
 
-    IgnoreList ignore = {0};
-    if (ignore_load(IGNORE_FILE, &ignore) != 0) {
-        fprintf(stderr, "Warning: failed to load ignore file. Continuing.\n");
+    RecordSet set;
+    if (store_load(INDEX_FILE, &set) != 0) {
+        fprintf(stderr, "Failed to load index.\n");
+        return EXIT_FAIL;
     }
-
-    FileRecord *old_records = NULL;
-    size_t old_count = 0;
-    if (store_load(INDEX_FILE, &old_records, &old_count) != 0) {
-        
-        old_records = NULL;
-        old_count = 0;
+    recset_sort(&set);
+
+    size_t first = 0;
+    VerifyCursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    if (restart) {
+        unlink(VERIFY_CURSOR_FILE);
+    } else if (verify_cursor_load(&cursor) == 0) {
+        first = recset_lower_bound(&set, cursor.path);
+        if (first < set.count) {
+            char path[PATH_MAX];
+            recset_path(&set, &set.records[first], path, sizeof(path));
+            if (strcmp(path, cursor.path) != 0) cursor.partial = false;
+            else if (!cursor.partial) first++;
+        }
     }
 
-    
-    int nstart = argc - 2;
-    char **start_paths = calloc((size_t)nstart, sizeof(char *));
-    for (int i = 0; i < nstart; i++) start_paths[i] = argv[2 + i];
-
-    FileRecord *new_records = NULL;
-    size_t new_count = 0;
-    int rc = collect_files(start_paths, nstart, &ignore, &new_records, &new_count);
-    free(start_paths);
-    if (rc != 0) {
-        ignore_free(&ignore);
-        store_free(old_records, old_count);
-        return EXIT_FAIL;
+    set_idle_io_priority();
+
+    struct sigaction sa, old_int, old_term;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_interrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    clock_gettime(CLOCK_MONOTONIC, &throttle.start);
+    if (time_limit) {
+        throttle.deadline = throttle.start;
+        throttle.deadline.tv_sec += (time_t)time_limit;
     }
 
-    
-    if (old_records && old_count > 1) qsort(old_records, old_count, sizeof(FileRecord), cmp_record_path);
-    if (new_records && new_count > 1) qsort(new_records, new_count, sizeof(FileRecord), cmp_record_path);
-
-    int added_count = 0;
-
-    for (size_t i = 0; i < new_count; i++) {
-        ssize_t idx = -1;
-        if (old_records) idx = find_record_idx(old_records, old_count, new_records[i].path);
-        if (idx < 0) {
-            
-            uint64_t h = 0;
-            if (new_records[i].size == 0) {
-                h = 0;
-            } else {
-                if (compute_file_hash(new_records[i].path, &h, NULL) != 0) {
-                    
-                    fprintf(stderr, "Failed to hash %s\n", new_records[i].path);
-                    ignore_free(&ignore);
-                    store_free(old_records, old_count);
-                    store_free(new_records, new_count);
-                    return EXIT_FAIL;
-                }
-            }
-            new_records[i].hash = h;
-            added_count++;
-        } else {
-            
-            FileRecord *old = &old_records[idx];
-            if (old->dev == new_records[i].dev && old->ino == new_records[i].ino) {
-                new_records[i].hash = old->hash;
-                
-            } else if (old->size == new_records[i].size && old->mtime == new_records[i].mtime) {
-                new_records[i].hash = old->hash;
-            } else {
-                
-                uint64_t h = 0;
-                if (new_records[i].size == 0) {
-                    h = 0;
-                } else {
-                    if (compute_file_hash(new_records[i].path, &h, NULL) != 0) {
-                        fprintf(stderr, "Failed to hash %s\n", new_records[i].path);
-                        ignore_free(&ignore);
-                        store_free(old_records, old_count);
-                        store_free(new_records, new_count);
-                        return EXIT_FAIL;
-                    }
-                }
-                new_records[i].hash = h;
-                if (h != old->hash) added_count++;
+    int changed = 0;
+    int ret = EXIT_OK;
+    bool progress = false;
+    size_t i = first;
+    char path[PATH_MAX];
+    VerifyCursor save;
+    memset(&save, 0, sizeof(save));
+
+    for (; i < set.count && !hash_interrupted && !throttle.expired; i++) {
+        const FileRecord *rec = &set.records[i];
+        recset_path(&set, rec, path, sizeof(path));
+
+        struct stat cur;
+        if (lstat(path, &cur) < 0 || !S_ISREG(cur.st_mode)) {
+            /* Missing files are reported by status, not by a scrub. */
+            strlcpy(save.path, path, sizeof(save.path));
+            progress = true;
+            continue;
+        }
+
+        uint64_t h = FNV_OFFSET, pos = 0;
+        if (i == first && cursor.partial && cursor.size == (uint64_t)cur.st_size &&
+            cursor.mtime_ns == stat_mtime_ns(&cur)) {
+            h = cursor.state;
+            pos = cursor.offset;
+        }
+        uint64_t start = pos;
+        if (compute_file_hash_from(AT_FDCWD, path, &h, &pos, &throttle) != 0) {
+            if (pos > start) progress = true;
+            if ((hash_interrupted || throttle.expired) && pos > 0) {
+                strlcpy(save.path, path, sizeof(save.path));
+                save.partial = true;
+                save.offset = pos;
+                save.state = h;
+                save.size = (uint64_t)cur.st_size;
+                save.mtime_ns = stat_mtime_ns(&cur);
             }
+            if (hash_interrupted || throttle.expired) break;
+            fprintf(stderr, "Failed to hash %s\n", path);
+            ret = EXIT_FAIL;
+            break;
         }
-    }
+        strlcpy(save.path, path, sizeof(save.path));
+        progress = true;
 
-    if (added_count == 0) {
-        ignore_free(&ignore);
-        store_free(old_records, old_count);
-        store_free(new_records, new_count);
-        return EXIT_ALREADY_ADDED;
+        if (h != rec->hash) {
+            bool same_meta = rec->size == (uint64_t)cur.st_size && rec->mtime == (uint64_t)cur.st_mtime;
+            printf("%s: %s\n", same_meta ? "Corrupted" : "Modified", path);
+            changed = 1;
+        }
     }
 
-    
-    if (store_save(INDEX_FILE, new_records, new_count) != 0) {
-        ignore_free(&ignore);
-        store_free(old_records, old_count);
-        store_free(new_records, new_count);
-        fprintf(stderr, "Failed to save index\n");
-        return EXIT_FAIL;
+    if (i >= set.count && ret == EXIT_OK) {
+        unlink(VERIFY_CURSOR_FILE);
+    } else if (save.path[0] != '\0' && verify_cursor_save(&save) != 0) {
+        fprintf(stderr, "Failed to save verify cursor\n");
+        ret = EXIT_FAIL;
+    }
+    if (i < set.count && ret == EXIT_OK) {
+        if (save.partial) {
+            fprintf(stderr, "Verify paused in %s after %" PRIu64 " of %" PRIu64 " bytes; rerun verify to continue.\n",
+                    save.path, save.offset, save.size);
+        } else {
+            fprintf(stderr, "Verify paused after %zu of %zu files; rerun verify to continue.\n", i, set.count);
+        }
+        if (hash_interrupted) {
+            ret = EXIT_INTERRUPTED;
+        } else if (!progress) {
+            fprintf(stderr, "No progress was made; raise --time-limit or --bwlimit.\n");
+            ret = EXIT_FAIL;
+        }
     }
 
-    ignore_free(&ignore);
-    store_free(old_records, old_count);
-    store_free(new_records, new_count);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    recset_free(&set);
 
+    if (ret != EXIT_OK) return ret;
+    if (changed) return EXIT_DIFF_FOUND;
     return EXIT_OK;
 }
 
+static bool has_any(const char *s, const char *chars) {
+    return strpbrk(s, chars) != NULL;
+}
 
-static int cmd_status(void) {
-    struct stat st;
-    if (stat(INDEX_FILE, &st) != 0) {
-        fprintf(stderr, "Not initialized.\n");
-        return EXIT_FAIL;
+#define REGEX_META ".[]()*+?{}|^$\\"
+
+/*
+ * Suggests a cheaper form of p, or NULL when there is none. A rewrite is
+ * only offered when it ignores the same files: the walk stops at an
+ * ignored directory, so ^name$ and /name agree, but ^name alone also
+ * matches namex and has no glob twin.
+ */
+static const char *pattern_hint(const IgnorePattern *p, const IgnoreStats *st) {
+    if (st->matches == 0) return "never matched; drop it if it is obsolete";
+    const char *pat = p->pattern;
+    size_t len = strlen(pat);
+    if (p->is_regex) {
+        char last = len > 0 ? pat[len - 1] : '\0';
+        if (pat[0] == '^' && len > 2 && last == '$' && strcspn(pat + 1, REGEX_META) == len - 2) {
+            return "exact-path regex; a /leading-slash glob matches the same";
+        }
+        if (len > 3 && strncmp(pat, "\\.", 2) == 0 && last == '$' && strcspn(pat + 2, REGEX_META "/") == len - 3) {
+            return "suffix regex; *.ext matches the same";
+        }
+        return "regex runs on every path; prefer a glob where one fits";
     }
+    if (p->matches_component || p->anchored) return NULL;
 
-    IgnoreList ignore = {0};
-    if (ignore_load(IGNORE_FILE, &ignore) != 0) {
-        fprintf(stderr, "Warning: failed to load ignore file. Continuing.\n");
+    if (strchr(pat, '/')) {
+        return has_any(pat, "*?[") ? "retried at every '/'; anchor with a leading / if meant for the top"
+                                   : "literal path retried at every '/'; anchor with a leading / if meant for the top";
     }
+    return NULL;
+}
 
-    FileRecord *old_records = NULL;
-    size_t old_count = 0;
-    if (store_load(INDEX_FILE, &old_records, &old_count) != 0) {
-        fprintf(stderr, "Failed to load index.\n");
-        ignore_free(&ignore);
-        return EXIT_FAIL;
-    }
+/* Timed patterns by time, then plain names, which are not timed, by components compared. */
+static int cmp_pattern_cost(const void *a, const void *b, void *arg) {
+    const IgnoreList *ignore = arg;
+    size_t i = *(const size_t *)a, j = *(const size_t *)b;
+    bool ci = ignore->patterns[i].matches_component, cj = ignore->patterns[j].matches_component;
+    if (ci != cj) return ci ? 1 : -1;
+    uint64_t x = ci ? ignore->stats[i].calls : ignore->stats[i].nanos;
+    uint64_t y = ci ? ignore->stats[j].calls : ignore->stats[j].nanos;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
 
-    
-    char *start = ".";
-    char *starts[1] = { start };
-    FileRecord *new_records = NULL;
-    size_t new_count = 0;
-    if (collect_files(starts, 1, &ignore, &new_records, &new_count) != 0) {
-        ignore_free(&ignore);
-        store_free(old_records, old_count);
-        return EXIT_FAIL;
+/*
+ * Walks the tree with per-pattern counters on and ranks patterns by time
+ * spent. Plain-name patterns cost less than a clock read, so they are
+ * listed last by the number of components they compared.
+ */
+static int ignore_profile(IgnoreList *ignore, const char *const *paths, int npaths) {
+    if (ignore_profile_start(ignore) != 0) err(EXIT_FAIL, "calloc");
+    int rootfd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootfd < 0) err(EXIT_FAIL, ".");
+
+    static const char *const whole[1] = { "." };
+    struct timespec t0, t1;
+    RecordSet set;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = collect_files(rootfd, npaths ? paths : whole, npaths ? npaths : 1, ignore, &set);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close(rootfd);
+    if (rc != 0) errx(EXIT_FAIL, "Failed to walk the tree");
+    recset_free(&set);
+
+    size_t n = ignore->count;
+    size_t *order = malloc((n ? n : 1) * sizeof(size_t));
+    if (!order) err(EXIT_FAIL, "malloc");
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+        total += ignore->stats[i].nanos;
     }
+    qsort_r(order, n, sizeof(size_t), cmp_pattern_cost, ignore);
+
+    double walk_ms = (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+    printf("%" PRIu64 " paths checked against %zu patterns; walk %.1f ms, ignore matching %.1f ms\n\n",
+           n ? ignore->stats[0].evals : 0, n, walk_ms, (double)total / 1e6);
+    printf("%4s %5s %9s %6s %9s %9s %9s  %s\n", "rank", "line", "time_ms", "share", "evals", "calls", "matches", "pattern");
+    for (size_t r = 0; r < n; r++) {
+        const IgnorePattern *p = &ignore->patterns[order[r]];
+        const IgnoreStats *st = &ignore->stats[order[r]];
+        char shown[PATH_MAX + 16];
+        snprintf(shown, sizeof(shown), "%s%s%s%s%s", p->negated ? "!" : "", p->anchored ? "/" : "",
+                 p->is_regex ? "re:" : "", p->pattern, p->dir_only ? "/" : "");
+        char time_ms[16] = "-", share[16] = "-";
+        if (!p->matches_component) {
+            snprintf(time_ms, sizeof(time_ms), "%.2f", (double)st->nanos / 1e6);
+            snprintf(share, sizeof(share), "%.1f%%", total ? 100.0 * (double)st->nanos / (double)total : 0.0);
+        }
+        printf("%4zu %5d %9s %6s %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "  %s\n", r + 1, p->line,
+               time_ms, share, st->evals, st->calls, st->matches, shown);
+        const char *hint = pattern_hint(p, st);
+        if (hint) printf("%51s-> %s\n", "", hint);
+    }
+    free(order);
+    return EXIT_OK;
+}
 
-    if (old_count > 1) qsort(old_records, old_count, sizeof(FileRecord), cmp_record_path);
-    if (new_count > 1) qsort(new_records, new_count, sizeof(FileRecord), cmp_record_path);
+/*
+ * check-ignore <path>... prints the given paths that .fdiffignore excludes.
+ * With --profile it walks the tree (or the given paths) instead and
+ * reports what every pattern cost.
+ */
+static int cmd_check_ignore(int argc, char *argv[]) {
+    bool profile = false;
+    const char **paths = calloc((size_t)argc, sizeof(char *));
+    int npaths = 0;
+    if (!paths) err(EXIT_FAIL, "calloc");
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0) profile = true;
+        else paths[npaths++] = argv[i];
+    }
 
-    int changed = 0;
+    IgnoreList ignore;
+    if (ignore_load(IGNORE_FILE, NULL, &ignore) != 0) errx(EXIT_FAIL, "Failed to load %s", IGNORE_FILE);
 
-    for (size_t i = 0; i < new_count; i++) {
-        ssize_t idx = -1;
-        if (old_records) idx = find_record_idx(old_records, old_count, new_records[i].path);
-        if (idx < 0) {
-            printf("Untracked: %s\n", new_records[i].path);
-            changed = 1;
-        } else {
-            FileRecord *old = &old_records[idx];
-            if (old->dev == new_records[i].dev && old->ino == new_records[i].ino) {
-                
-            } else if (old->size == new_records[i].size && old->mtime == new_records[i].mtime) {
-                
-            } else {
-                
-                uint64_t h = 0;
-                if (new_records[i].size == 0) {
-                    h = 0;
-                } else {
-                    if (compute_file_hash(new_records[i].path, &h, NULL) != 0) {
-                        fprintf(stderr, "Failed to hash %s\n", new_records[i].path);
-                        ignore_free(&ignore);
-                        store_free(old_records, old_count);
-                        store_free(new_records, new_count);
-                        return EXIT_FAIL;
-                    }
-                }
-                if (h != old->hash) {
-                    printf("Modified: %s\n", new_records[i].path);
-                    changed = 1;
-                }
+    int ret;
+    if (profile) {
+        ret = ignore_profile(&ignore, paths, npaths);
+    } else if (npaths == 0) {
+        fprintf(stderr, "No path specified to check.\n");
+        ret = EXIT_FAIL;
+    } else {
+        ret = EXIT_FAIL;
+        for (int i = 0; i < npaths; i++) {
+            struct stat st;
+            int is_dir = lstat(paths[i], &st) == 0 && S_ISDIR(st.st_mode);
+            if (ignore_match_path(&ignore, paths[i], is_dir)) {
+                printf("%s\n", paths[i]);
+                ret = EXIT_OK;
             }
         }
     }
-
-    
-    for (size_t i = 0; i < old_count; i++) {
-        ssize_t idx = find_record_idx(new_records, new_count, old_records[i].path);
-        if (idx == -1) {
-            printf("Deleted: %s\n", old_records[i].path);
-            changed = 1;
-        }
-    }
-
     ignore_free(&ignore);
-    store_free(old_records, old_count);
-    store_free(new_records, new_count);
-
-    if (changed) return EXIT_DIFF_FOUND;
-    return EXIT_OK;
+    free(paths);
+    return ret;
 }
 
 static void print_help(void) {
     printf("fdiff - simple file difference tracker\n\n");
     printf("Usage:\n");
-    printf("  fdiff init             Initialize a new fdiff\n");
+    printf("  fdiff init [--snapshots]\n");
+    printf("                         Initialize a new fdiff; --snapshots keeps file contents for diff\n");
     printf("  fdiff add <path>...    Add file(s) or directories to tracking\n");
-    printf("  fdiff status           Show status of tracked vs current files\n");
+    printf("  fdiff status [path...] Show status of tracked vs current files\n");
+    printf("      --quick              Check files listed in .fdiffquick by sampling first\n");
+    printf("      -C <dir>             Check the repository at dir (repeatable)\n");
+    printf("      --roots <file>       Check every repository listed in file, one per line\n");
+    printf("  fdiff diff [path...]   Show line changes of modified files since their snapshot\n");
+    printf("  fdiff check-ignore <path>...\n");
+    printf("                         Print the paths that .fdiffignore excludes\n");
+    printf("      --profile            Walk the tree and rank ignore patterns by cost\n");
+    printf("  fdiff verify [options] Rehash tracked files and report silent changes\n");
+    printf("      --bwlimit <bytes>    Read at most this many bytes per second (K/M/G)\n");
+    printf("      --iops <n>           Issue at most this many reads per second\n");
+    printf("      --time-limit <time>  Stop after this many seconds (or m/h) and resume later\n");
+    printf("      --restart            Discard the saved position and start over\n");
     printf("  fdiff help             Show this help message\n\n");
     printf("Notes:\n");
     printf("  - Ignores files matching patterns in .fdiffignore\n");
@@ -531,7 +769,7 @@ int main(int argc, char *argv[]) {
     }
 
     if (strcmp(argv[1], "init") == 0) {
-        return cmd_init();
+        return cmd_init(argc, argv);
     } else if (strcmp(argv[1], "add") == 0) {
         if (argc < 3) {
             fprintf(stderr, "No path specified to add.\n");
@@ -539,7 +777,13 @@ int main(int argc, char *argv[]) {
         }
         return cmd_add(argc, argv);
     } else if (strcmp(argv[1], "status") == 0) {
-        return cmd_status();
+        return cmd_status(argc, argv);
+    } else if (strcmp(argv[1], "diff") == 0) {
+        return cmd_diff(argc, argv);
+    } else if (strcmp(argv[1], "check-ignore") == 0) {
+        return cmd_check_ignore(argc, argv);
+    } else if (strcmp(argv[1], "verify") == 0) {
+        return cmd_verify(argc, argv);
     } else if (strcmp(argv[1], "help") == 0) {
         print_help();
         return EXIT_OK;
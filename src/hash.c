@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <time.h>
+
+volatile sig_atomic_t hash_interrupted = 0;
+
+static double timespec_diff(const struct timespec *a, const struct timespec *b) {
+    return (double)(a->tv_sec - b->tv_sec) + (double)(a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+int throttle_account(Throttle *t, size_t n) {
+    double cost = 0;
+    if (t->bytes_per_sec) cost = (double)n / (double)t->bytes_per_sec;
+    if (t->iops) {
+        double c = 1.0 / (double)t->iops;
+        if (c > cost) cost = c;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = timespec_diff(&now, &t->start);
+    /* Time spent not reading earns at most THROTTLE_BURST_SEC of credit. */
+    if (t->sched < elapsed - THROTTLE_BURST_SEC) t->sched = elapsed - THROTTLE_BURST_SEC;
+    t->sched += cost;
+
+    double wait = t->sched - elapsed;
+    if (wait > 0) {
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR && !hash_interrupted);
+        if (hash_interrupted) return -1;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    if (t->deadline.tv_sec != 0 && timespec_diff(&now, &t->deadline) >= 0) {
+        t->expired = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FNV-1a of a zero byte is a bare multiply, so a run of n zeros folds into
+ * h * FNV_PRIME^n. Holes in sparse files are hashed this way without
+ * reading them, and the result equals a dense read.
+ */
+static uint64_t fnv_zeros(uint64_t h, uint64_t n) {
+    uint64_t p = FNV_PRIME;
+    while (n) {
+        if (n & 1) h *= p;
+        p *= p;
+        n >>= 1;
+    }
+    return h;
+}
+
+/*
+ * Hashes up to limit bytes from the current offset, stopping early at end
+ * of file. *pos advances with every read folded into *h, so the pair stays
+ * consistent when a read, the throttle or an interrupt fails the call.
+ */
+static int hash_read(int fd, unsigned char *buf, size_t buf_sz, uint64_t limit, uint64_t *h, uint64_t *pos, Throttle *throttle) {
+    uint64_t done = 0;
+    while (done < limit) {
+        if (hash_interrupted) return -1;
+        size_t want = limit - done < buf_sz ? (size_t)(limit - done) : buf_sz;
+        ssize_t r = read(fd, buf, want);
+        if (r < 0 && errno == EINTR && !hash_interrupted) continue;
+        if (r < 0) return -1;
+        if (r == 0) break;
+        uint64_t x = *h;
+        for (ssize_t i = 0; i < r; i++) {
+            x ^= (uint64_t)buf[i];
+            x *= FNV_PRIME;
+        }
+        *h = x;
+        done += (uint64_t)r;
+        *pos += (uint64_t)r;
+        if (throttle && throttle_account(throttle, (size_t)r) != 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * Walks the data extents of a sparse file with SEEK_DATA/SEEK_HOLE from
+ * *pos on. Returns 1 when the filesystem cannot report extents and the
+ * caller should fall back to a dense read.
+ */
+static int hash_sparse(int fd, uint64_t size, unsigned char *buf, size_t buf_sz, uint64_t *h, uint64_t *pos, Throttle *throttle) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    int first = 1;
+    while (*pos < size) {
+        off_t data = lseek(fd, (off_t)*pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) data = (off_t)size;
+            else if (first) return 1;
+            else return -1;
+        }
+        first = 0;
+        if ((uint64_t)data > size) data = (off_t)size;
+        *h = fnv_zeros(*h, (uint64_t)data - *pos);
+        *pos = (uint64_t)data;
+        if (*pos >= size) break;
+
+        off_t hole = lseek(fd, (off_t)*pos, SEEK_HOLE);
+        if (hole < 0 || (uint64_t)hole > size) hole = (off_t)size;
+        if (lseek(fd, (off_t)*pos, SEEK_SET) < 0) return -1;
+        uint64_t end = (uint64_t)hole;
+        if (hash_read(fd, buf, buf_sz, end - *pos, h, pos, throttle) != 0) return -1;
+        if (*pos < end) break; /* truncated while hashing */
+    }
+    return 0;
+#else
+    (void)fd; (void)size; (void)buf; (void)buf_sz; (void)h; (void)pos; (void)throttle;
+    return 1;
+#endif
+}
+
+/* Hashes fd from *pos to the end, sparse-aware. */
+static int hash_fd(int fd, const struct stat *st, uint64_t *h, uint64_t *pos, Throttle *throttle) {
+    const size_t BUF_SZ = 1 << 16;
+    unsigned char *buf = malloc(BUF_SZ);
+    if (!buf) return -1;
+
+    /* Fewer allocated blocks than the size implies means the file has holes. */
+    int rc = 1;
+    if ((uint64_t)st->st_blocks * 512 < (uint64_t)st->st_size) {
+        rc = hash_sparse(fd, (uint64_t)st->st_size, buf, BUF_SZ, h, pos, throttle);
+    }
+    if (rc == 1) {
+        rc = lseek(fd, (off_t)*pos, SEEK_SET) < 0 ? -1 : hash_read(fd, buf, BUF_SZ, UINT64_MAX, h, pos, throttle);
+    }
+    free(buf);
+    return rc;
+}
+
+
+int compute_file_hash(int dirfd, const char *path, uint64_t *out_hash, uint64_t *out_size,
+                      Throttle *throttle, HashCache *cache) {
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        *out_hash = 0;
+        if (out_size) *out_size = 0;
+        close(fd);
+        return 0;
+    }
+
+    uint64_t h = FNV_OFFSET;
+    if (hcache_lookup(cache, &st, HASH_ALGO_FNV1A64, &h) == 0) {
+        *out_hash = h;
+        if (out_size) *out_size = (uint64_t)st.st_size;
+        close(fd);
+        return 0;
+    }
+
+    uint64_t pos = 0;
+    if (hash_fd(fd, &st, &h, &pos, throttle) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* Only remember the hash if nobody wrote to the file while we read it. */
+    struct stat after;
+    if (cache && fstat(fd, &after) == 0 && after.st_size == st.st_size &&
+        after.st_mtim.tv_sec == st.st_mtim.tv_sec && after.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+        after.st_ctim.tv_sec == st.st_ctim.tv_sec && after.st_ctim.tv_nsec == st.st_ctim.tv_nsec) {
+        hcache_insert(cache, &st, HASH_ALGO_FNV1A64, h);
+    }
+
+    *out_hash = h;
+    if (out_size) *out_size = (uint64_t)st.st_size;
+    close(fd);
+    return 0;
+}
+
+int compute_file_hash_from(int dirfd, const char *path, uint64_t *state, uint64_t *pos, Throttle *throttle) {
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || *pos > (uint64_t)st.st_size) {
+        close(fd);
+        return -1;
+    }
+    int rc = 0;
+    if (st.st_size == 0) *state = 0;
+    else rc = hash_fd(fd, &st, state, pos, throttle);
+    close(fd);
+    return rc;
+}
+
+
+int compute_quick_fingerprint(int dirfd, const char *path, uint64_t *out) {
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t h = FNV_OFFSET;
+    for (int i = 0; i < 8; i++) {
+        h ^= (size >> (8 * i)) & 0xff;
+        h *= FNV_PRIME;
+    }
+
+    /* Small files are covered whole; otherwise head, evenly spaced blocks, tail. */
+    const uint64_t nblocks = QUICK_SAMPLES + 2;
+    unsigned char buf[QUICK_SAMPLE_SIZE];
+    int rc = 0;
+    for (uint64_t b = 0; b < nblocks && rc == 0; b++) {
+        uint64_t off;
+        if (size <= nblocks * QUICK_SAMPLE_SIZE) off = b * QUICK_SAMPLE_SIZE;
+        else if (b == nblocks - 1) off = size - QUICK_SAMPLE_SIZE;
+        else off = b * ((size - QUICK_SAMPLE_SIZE) / (nblocks - 1));
+        if (off >= size) break;
+
+        size_t want = size - off < QUICK_SAMPLE_SIZE ? (size_t)(size - off) : QUICK_SAMPLE_SIZE;
+        size_t got = 0;
+        while (got < want) {
+            if (hash_interrupted) {
+                rc = -1;
+                break;
+            }
+            ssize_t r = pread(fd, buf + got, want - got, (off_t)(off + got));
+            if (r < 0 && errno == EINTR && !hash_interrupted) continue;
+            if (r < 0) rc = -1;
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        for (size_t i = 0; i < got; i++) {
+            h ^= (uint64_t)buf[i];
+            h *= FNV_PRIME;
+        }
+    }
+    close(fd);
+    if (rc != 0) return -1;
+    *out = h ? h : 1;
+    return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef FDIFF_HASH_H
+#define FDIFF_HASH_H
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include "hcache.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define HASH_ALGO_FNV1A64 1
+
+/* Quick fingerprints hash the size, the head, the tail and QUICK_SAMPLES blocks in between. */
+#define QUICK_SAMPLE_SIZE 4096
+#define QUICK_SAMPLES 16
+
+/*
+ * Paces reads for background work such as verify: every read is charged
+ * the time it takes at the byte rate or the read rate cap, whichever is
+ * longer (0 = unlimited), and the caller sleeps until the reads so far
+ * are paid for. Idle stretches bank at most THROTTLE_BURST_SEC, so a slow
+ * disk or a run of skipped files is not followed by an uncapped burst. A
+ * read past the deadline fails and sets expired; an interrupt cuts the
+ * sleep short and fails as well.
+ */
+#define THROTTLE_BURST_SEC 0.1
+
+typedef struct {
+    uint64_t bytes_per_sec;
+    uint64_t iops;
+    struct timespec start;
+    struct timespec deadline; /* tv_sec == 0 means none */
+    double sched;  /* seconds after start when the reads so far are paid for */
+    int expired;
+} Throttle;
+
+/* Set from a signal handler; hashing loops check it before every read and fail. */
+extern volatile sig_atomic_t hash_interrupted;
+
+int throttle_account(Throttle *t, size_t n);
+
+/*
+ * Hashes a regular file relative to dirfd. With a cache, a file whose
+ * identity is already known is not read, and a fresh result is stored.
+ */
+int compute_file_hash(int dirfd, const char *path, uint64_t *out_hash, uint64_t *out_size,
+                      Throttle *throttle, HashCache *cache);
+
+/*
+ * Continues hashing a regular file: reads from *pos on, folding
+ * into *state (FNV_OFFSET and 0 to start over). When throttle expires or
+ * an interrupt arrives it fails with *state and *pos describing the bytes
+ * hashed so far, so a later call can pick up there. An empty file hashes
+ * to 0, as with compute_file_hash.
+ */
+int compute_file_hash_from(int dirfd, const char *path, uint64_t *state, uint64_t *pos, Throttle *throttle);
+
+/*
+ * Computes the sampled fingerprint of a regular file, never 0. It reads
+ * at most (QUICK_SAMPLES + 2) * QUICK_SAMPLE_SIZE bytes whatever the file
+ * size, so a mismatch proves a change cheaply; a match proves nothing.
+ */
+int compute_quick_fingerprint(int dirfd, const char *path, uint64_t *out);
+
+#endif
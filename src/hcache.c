@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "hcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+
+#define HCACHE_NSLOTS (1u << 18)
+#define HCACHE_WINDOW 8
+#define HCACHE_HEADER_SIZE 64
+
+static const char HCACHE_MAGIC[8] = { 'F', 'D', 'I', 'F', 'F', 'H', 'C', '1' };
+
+typedef struct {
+    char magic[8];
+    uint32_t slot_size;
+    uint32_t reserved;
+    uint64_t nslots;
+    uint64_t clock;     /* bumped on every insert, orders slot stamps */
+} HcacheHeader;
+
+/*
+ * seq is 0 for a never used slot, odd while a writer owns it and even
+ * otherwise. Readers copy the slot and retry nothing: if seq moved the
+ * entry is treated as a miss.
+ */
+typedef struct {
+    uint64_t seq;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint64_t ctime_ns;
+    uint64_t algo;
+    uint64_t hash;
+    uint64_t stamp;
+    uint64_t pad;
+} HcacheSlot;
+
+struct HashCache {
+    void *map;
+    size_t len;
+    HcacheHeader *hdr;
+    HcacheSlot *slots;
+    uint64_t nslots;
+};
+
+typedef struct {
+    uint64_t dev, ino, size, mtime_ns, ctime_ns, algo;
+} HcacheKey;
+
+
+static void make_key(HcacheKey *k, const struct stat *st, uint32_t algo) {
+    k->dev = (uint64_t)st->st_dev;
+    k->ino = (uint64_t)st->st_ino;
+    k->size = (uint64_t)st->st_size;
+    k->mtime_ns = (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + (uint64_t)st->st_mtim.tv_nsec;
+    k->ctime_ns = (uint64_t)st->st_ctim.tv_sec * 1000000000ULL + (uint64_t)st->st_ctim.tv_nsec;
+    k->algo = algo;
+}
+
+static uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t key_slot(const HashCache *c, const HcacheKey *k) {
+    uint64_t h = mix(mix(mix(0, k->dev), k->ino), k->size);
+    h = mix(mix(mix(h, k->mtime_ns), k->ctime_ns), k->algo);
+    return h & (c->nslots - 1);
+}
+
+#define LOAD(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELAXED)
+
+static int slot_matches(HcacheSlot *s, const HcacheKey *k) {
+    return LOAD(s->dev) == k->dev && LOAD(s->ino) == k->ino && LOAD(s->size) == k->size &&
+           LOAD(s->mtime_ns) == k->mtime_ns && LOAD(s->ctime_ns) == k->ctime_ns &&
+           LOAD(s->algo) == k->algo;
+}
+
+
+static char *default_path(void) {
+    const char *env = getenv("FDIFF_HASH_CACHE");
+    if (!env || env[0] == '\0' || strcmp(env, "0") == 0) return NULL;
+    if (strcmp(env, "1") != 0) return strdup(env);
+
+    char dir[PATH_MAX];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && xdg[0] == '/') snprintf(dir, sizeof(dir), "%s/fdiff", xdg);
+    else if (home) snprintf(dir, sizeof(dir), "%s/.cache/fdiff", home);
+    else return NULL;
+
+    /* Create the parent when it is missing, as XDG expects. */
+    if (mkdir(dir, 0700) != 0 && errno == ENOENT) {
+        char *slash = strrchr(dir, '/');
+        *slash = '\0';
+        mkdir(dir, 0700);
+        *slash = '/';
+        mkdir(dir, 0700);
+    }
+
+    size_t need = strlen(dir) + sizeof("/hashcache");
+    char *path = malloc(need);
+    if (path) snprintf(path, need, "%s/hashcache", dir);
+    return path;
+}
+
+HashCache *hcache_open_default(void) {
+    char *path = default_path();
+    if (!path) return NULL;
+    HashCache *c = hcache_open(path);
+    free(path);
+    return c;
+}
+
+HashCache *hcache_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return NULL;
+
+    size_t len = HCACHE_HEADER_SIZE + (size_t)HCACHE_NSLOTS * sizeof(HcacheSlot);
+    struct stat st;
+
+    /* Only creation is serialized; once initialized nobody takes the lock. */
+    if (flock(fd, LOCK_EX) != 0) goto err;
+    if (fstat(fd, &st) != 0) goto err_unlock;
+    if (st.st_size == 0) {
+        HcacheHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, HCACHE_MAGIC, sizeof(h.magic));
+        h.slot_size = sizeof(HcacheSlot);
+        h.nslots = HCACHE_NSLOTS;
+        if (ftruncate(fd, (off_t)len) != 0) goto err_unlock;
+        if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) goto err_unlock;
+        st.st_size = (off_t)len;
+    }
+    flock(fd, LOCK_UN);
+
+    HcacheHeader h;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) goto err;
+    if (memcmp(h.magic, HCACHE_MAGIC, sizeof(h.magic)) != 0 || h.slot_size != sizeof(HcacheSlot)) goto err;
+    if (h.nslots == 0 || (h.nslots & (h.nslots - 1)) != 0) goto err;
+    len = HCACHE_HEADER_SIZE + (size_t)h.nslots * sizeof(HcacheSlot);
+    if ((size_t)st.st_size < len) goto err;
+
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    HashCache *c = malloc(sizeof(*c));
+    if (!c) {
+        munmap(map, len);
+        return NULL;
+    }
+    c->map = map;
+    c->len = len;
+    c->hdr = map;
+    c->slots = (HcacheSlot *)((char *)map + HCACHE_HEADER_SIZE);
+    c->nslots = h.nslots;
+    return c;
+
+err_unlock:
+    flock(fd, LOCK_UN);
+err:
+    close(fd);
+    return NULL;
+}
+
+void hcache_close(HashCache *cache) {
+    if (!cache) return;
+    munmap(cache->map, cache->len);
+    free(cache);
+}
+
+
+int hcache_lookup(HashCache *cache, const struct stat *st, uint32_t algo, uint64_t *out_hash) {
+    if (!cache) return -1;
+    HcacheKey k;
+    make_key(&k, st, algo);
+    uint64_t base = key_slot(cache, &k);
+    for (uint64_t i = 0; i < HCACHE_WINDOW; i++) {
+        HcacheSlot *s = &cache->slots[(base + i) & (cache->nslots - 1)];
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || (seq & 1)) continue;
+        if (!slot_matches(s, &k)) continue;
+        uint64_t hash = LOAD(s->hash);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (LOAD(s->seq) != seq) continue;
+
+        /* Refresh the stamp only when stale, to keep hits from dirtying pages. */
+        uint64_t clock = LOAD(cache->hdr->clock);
+        if (clock - LOAD(s->stamp) > cache->nslots / 4) STORE(s->stamp, clock);
+        *out_hash = hash;
+        return 0;
+    }
+    return -1;
+}
+
+void hcache_insert(HashCache *cache, const struct stat *st, uint32_t algo, uint64_t hash) {
+    if (!cache) return;
+    HcacheKey k;
+    make_key(&k, st, algo);
+    uint64_t base = key_slot(cache, &k);
+
+    /* Prefer the slot already holding this key, then an empty one, then the oldest. */
+    HcacheSlot *victim = NULL;
+    int rank = 3;
+    uint64_t oldest = UINT64_MAX;
+    for (uint64_t i = 0; i < HCACHE_WINDOW && rank > 0; i++) {
+        HcacheSlot *s = &cache->slots[(base + i) & (cache->nslots - 1)];
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        if (seq != 0 && slot_matches(s, &k)) {
+            victim = s;
+            rank = 0;
+        } else if (seq == 0 && rank > 1) {
+            victim = s;
+            rank = 1;
+        } else if (rank == 3 || (rank == 2 && LOAD(s->stamp) < oldest)) {
+            victim = s;
+            rank = 2;
+            oldest = LOAD(s->stamp);
+        }
+    }
+    if (!victim) return;
+
+    uint64_t seq = __atomic_load_n(&victim->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, false,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return; /* another writer owns it; this is only a cache */
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    STORE(victim->dev, k.dev);
+    STORE(victim->ino, k.ino);
+    STORE(victim->size, k.size);
+    STORE(victim->mtime_ns, k.mtime_ns);
+    STORE(victim->ctime_ns, k.ctime_ns);
+    STORE(victim->algo, k.algo);
+    STORE(victim->hash, hash);
+    STORE(victim->stamp, __atomic_add_fetch(&cache->hdr->clock, 1, __ATOMIC_RELAXED));
+    __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
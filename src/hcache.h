@@ -0,0 +1,24 @@
+#ifndef FDIFF_HCACHE_H
+#define FDIFF_HCACHE_H
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * Hash cache shared by every fdiff repo of a user: a memory-mapped,
+ * fixed-size open addressing table from file identity (dev, ino, size,
+ * mtime, ctime, algorithm) to content hash. Lookups take no locks; each
+ * slot is guarded by a sequence counter and a torn read is a miss. A full
+ * probe window evicts its least recently used slot.
+ *
+ * Enabled by FDIFF_HASH_CACHE: "1" uses $XDG_CACHE_HOME/fdiff/hashcache
+ * (or ~/.cache/fdiff/hashcache), any other value is taken as the file.
+ */
+typedef struct HashCache HashCache;
+
+HashCache *hcache_open_default(void);
+HashCache *hcache_open(const char *path);
+int hcache_lookup(HashCache *cache, const struct stat *st, uint32_t algo, uint64_t *out_hash);
+void hcache_insert(HashCache *cache, const struct stat *st, uint32_t algo, uint64_t hash);
+void hcache_close(HashCache *cache);
+
+#endif
@@ -10,6 +10,7 @@
 #include <limits.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
 #include <bsd/string.h>
 
 static char *trim_whitespace(char *s) {
@@ -20,17 +21,22 @@ static char *trim_whitespace(char *s) {
     return s;
 }
 
-int ignore_load(const char *path, IgnoreList *ignore) {
+int ignore_load(const char *path, const char *root, IgnoreList *ignore) {
     if (!ignore) return -1;
     ignore->patterns = NULL;
     ignore->count = 0;
     ignore->root = NULL;
+    ignore->stats = NULL;
+    ignore->clock_nanos = 0;
 
     char cwd[PATH_MAX];
-    if (!getcwd(cwd, sizeof(cwd))) {
-        return -1;
+    if (!root) {
+        if (!getcwd(cwd, sizeof(cwd))) {
+            return -1;
+        }
+        root = cwd;
     }
-    ignore->root = strdup(cwd);
+    ignore->root = strdup(root);
     if (!ignore->root) return -1;
 
     FILE *f = fopen(path, "r");
@@ -40,7 +46,9 @@ int ignore_load(const char *path, IgnoreList *ignore) {
     }
 
     char line[4096];
+    int lineno = 0;
     while (fgets(line, sizeof(line), f)) {
+        lineno++;
         char *ln = trim_whitespace(line);
         if (!ln || ln[0] == '\0' || ln[0] == '#') continue;
 
@@ -51,6 +59,7 @@ int ignore_load(const char *path, IgnoreList *ignore) {
         pat.anchored = false;
         pat.matches_component = false;
         pat.pattern = NULL;
+        pat.line = lineno;
 
         if (ln[0] == '!') {
             pat.negated = true;
@@ -122,6 +131,76 @@ oom:
 }
 
 
+/*
+ * Whether one pattern matches; calls, if given, counts regexec/fnmatch
+ * runs, or the components compared for a plain name.
+ */
+static bool pattern_match(const IgnorePattern *p, const char *tmp, int is_dir, uint64_t *calls) {
+    bool this_match = false;
+    uint64_t n = 0;
+
+    if (p->is_regex) {
+        
+        n++;
+        if (regexec(&p->regex, tmp, 0, NULL, 0) == 0) this_match = true;
+    } else if (p->matches_component) {
+        
+        if (strcmp(p->pattern, ".") == 0 && strcmp(tmp, ".") == 0) this_match = true;
+        const char *tok = tmp;
+        while (tok) {
+            n++;
+            const char *slash = strchr(tok, '/');
+            size_t len = slash ? (size_t)(slash - tok) : strlen(tok);
+            if (len == strlen(p->pattern) && strncmp(tok, p->pattern, len) == 0) {
+                this_match = true;
+                break;
+            }
+            if (!slash) break;
+            tok = slash + 1;
+        }
+        
+        if (this_match && p->anchored) {
+            size_t len = strlen(p->pattern);
+            if (strncmp(tmp, p->pattern, len) != 0 || (tmp[len] != '\0' && tmp[len] != '/')) this_match = false;
+        }
+    } else {
+        
+        
+        n++;
+        if (p->anchored) {
+            if (fnmatch(p->pattern, tmp, FNM_PATHNAME) == 0) this_match = true;
+        } else {
+            if (fnmatch(p->pattern, tmp, FNM_PATHNAME) == 0) {
+                this_match = true;
+            } else {
+                const char *s = tmp;
+                while ((s = strchr(s, '/')) != NULL) {
+                    s++; 
+                    n++;
+                    if (fnmatch(p->pattern, s, FNM_PATHNAME) == 0) {
+                        this_match = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    if (this_match) {
+        if (p->dir_only && !is_dir) {
+            this_match = false;
+        }
+    }
+    if (calls) *calls += n;
+    return this_match;
+}
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 bool ignore_match(const IgnoreList *ignore, const char *relpath, int is_dir) {
     if (!ignore || ignore->count == 0) return false;
     if (!relpath) return false;
@@ -134,55 +213,23 @@ bool ignore_match(const IgnoreList *ignore, const char *relpath, int is_dir) {
     
     bool matched = false;
     for (size_t i = 0; i < ignore->count; i++) {
-        IgnorePattern *p = &ignore->patterns[i];
-        bool this_match = false;
-
-        if (p->is_regex) {
-            
-            if (regexec(&p->regex, tmp, 0, NULL, 0) == 0) this_match = true;
-        } else if (p->matches_component) {
-            
-            if (strcmp(p->pattern, ".") == 0 && strcmp(tmp, ".") == 0) this_match = true;
-            char *tok = tmp;
-            while (tok) {
-                char *slash = strchr(tok, '/');
-                size_t len = slash ? (size_t)(slash - tok) : strlen(tok);
-                if (len == strlen(p->pattern) && strncmp(tok, p->pattern, len) == 0) {
-                    this_match = true;
-                    break;
-                }
-                if (!slash) break;
-                tok = slash + 1;
-            }
-            
-            if (this_match && p->anchored) {
-                if (strncmp(tmp, p->pattern, strlen(p->pattern)) != 0) this_match = false;
-            }
-        } else {
-            
-            
-            if (p->anchored) {
-                if (fnmatch(p->pattern, tmp, FNM_PATHNAME) == 0) this_match = true;
+        const IgnorePattern *p = &ignore->patterns[i];
+        bool this_match;
+        if (ignore->stats) {
+            IgnoreStats *st = &ignore->stats[i];
+            /* A component compare costs less than the clock read around it; count those instead. */
+            if (p->matches_component) {
+                this_match = pattern_match(p, tmp, is_dir, &st->calls);
             } else {
-                if (fnmatch(p->pattern, tmp, FNM_PATHNAME) == 0) {
-                    this_match = true;
-                } else {
-                    char *s = tmp;
-                    while ((s = strchr(s, '/')) != NULL) {
-                        s++; 
-                        if (fnmatch(p->pattern, s, FNM_PATHNAME) == 0) {
-                            this_match = true;
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-
-        if (this_match) {
-            if (p->dir_only && !is_dir) {
-                this_match = false;
+                uint64_t t0 = now_nanos();
+                this_match = pattern_match(p, tmp, is_dir, &st->calls);
+                uint64_t dt = now_nanos() - t0;
+                st->nanos += dt > ignore->clock_nanos ? dt - ignore->clock_nanos : 0;
             }
+            st->evals++;
+            st->matches += this_match;
+        } else {
+            this_match = pattern_match(p, tmp, is_dir, NULL);
         }
 
         if (this_match) {
@@ -193,6 +240,45 @@ bool ignore_match(const IgnoreList *ignore, const char *relpath, int is_dir) {
     return matched;
 }
 
+/* Whether relpath, or a directory above it, is ignored. */
+bool ignore_match_path(const IgnoreList *ignore, const char *relpath, int is_dir) {
+    char tmp[PATH_MAX];
+    if (strlcpy(tmp, relpath, sizeof(tmp)) >= sizeof(tmp)) return false;
+    for (char *slash = strchr(tmp, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        bool hit = ignore_match(ignore, tmp, 1);
+        *slash = '/';
+        if (hit) return true;
+    }
+    return ignore_match(ignore, tmp, is_dir);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Starts counting per-pattern work in ignore_match; freed by ignore_free.
+ * The median cost of two back-to-back clock reads is taken out of every
+ * timed eval so cheap patterns are not ranked by timer overhead.
+ */
+int ignore_profile_start(IgnoreList *ignore) {
+    free(ignore->stats);
+    ignore->stats = calloc(ignore->count ? ignore->count : 1, sizeof(IgnoreStats));
+    if (!ignore->stats) return -1;
+
+    uint64_t samples[255];
+    size_t n = sizeof(samples) / sizeof(samples[0]);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t t0 = now_nanos();
+        samples[i] = now_nanos() - t0;
+    }
+    qsort(samples, n, sizeof(samples[0]), cmp_u64);
+    ignore->clock_nanos = samples[n / 2];
+    return 0;
+}
+
 void ignore_free(IgnoreList *ignore) {
     if (!ignore) return;
     for (size_t i = 0; i < ignore->count; i++) {
@@ -204,5 +290,7 @@ void ignore_free(IgnoreList *ignore) {
     ignore->count = 0;
     if (ignore->root) free(ignore->root);
     ignore->root = NULL;
+    free(ignore->stats);
+    ignore->stats = NULL;
 }
 
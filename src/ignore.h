@@ -1,6 +1,7 @@
 #ifndef FDIFF_IGNORE_H
 #define FDIFF_IGNORE_H
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <regex.h>
 
@@ -12,17 +13,30 @@ typedef struct {
     bool dir_only;
     bool anchored;       
     bool matches_component; 
+    int line;            /* line number in the ignore file */
 } IgnorePattern;
 
+/* Per-pattern counters, kept by ignore_match while profiling. */
+typedef struct {
+    uint64_t evals;
+    uint64_t matches;
+    uint64_t calls;      /* regexec/fnmatch runs counting every suffix retry, or components compared */
+    uint64_t nanos;      /* regexec/fnmatch patterns only, clock overhead taken out */
+} IgnoreStats;
+
 typedef struct {
     IgnorePattern *patterns;
     size_t count;
     char *root; 
+    IgnoreStats *stats;  /* one per pattern, NULL unless profiling */
+    uint64_t clock_nanos; /* cost of one clock read pair, measured by ignore_profile_start */
 } IgnoreList;
 
-int ignore_load(const char *path, IgnoreList *ignore);
+int ignore_load(const char *path, const char *root, IgnoreList *ignore);
 bool ignore_match(const IgnoreList *ignore, const char *relpath, int is_dir);
+bool ignore_match_path(const IgnoreList *ignore, const char *relpath, int is_dir);
 void ignore_free(IgnoreList *ignore);
+int ignore_profile_start(IgnoreList *ignore);
 
 #endif
 
@@ -0,0 +1,1004 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "libfdiff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <time.h>
+#include <bsd/string.h>
+
+#include "diff.h"
+#include "hash.h"
+#include "ignore.h"
+#include "objects.h"
+#include "pool.h"
+#include "store.h"
+#include "walk.h"
+
+#define CHECKPOINT_FILE ".fdiff/add.checkpoint"
+#define CHECKPOINT_INTERVAL_SEC 10
+#define DIFF_MAX_THREADS 16
+
+/* Identity of a file on disk, to notice when it has been replaced. */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtim;
+    int valid;
+} FileStamp;
+
+struct fdiff_repo {
+    char *root;
+    int rootfd;
+    char *index_path;
+    char *ignore_path;
+    char *quick_path;
+    char *checkpoint_path;
+    char *objects_dir;
+    HashCache *cache;  /* NULL unless FDIFF_HASH_CACHE is set */
+
+    IgnoreList ignore;
+    FileStamp ignore_stamp;
+    IgnoreList quick_rules;  /* files that get a sampled fingerprint */
+    FileStamp quick_stamp;
+    int quick;
+    RecordSet index;   /* sorted, loaded on first full use */
+    FileStamp index_stamp;
+    int index_loaded;
+    int index_ok;
+
+    char err[PATH_MAX + 64];
+};
+
+
+static void set_error(fdiff_repo *repo, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(repo->err, sizeof(repo->err), fmt, ap);
+    va_end(ap);
+}
+
+static char *join_path(const char *root, const char *rel) {
+    size_t need = strlen(root) + 1 + strlen(rel) + 1;
+    char *p = malloc(need);
+    if (!p) return NULL;
+    snprintf(p, need, "%s/%s", root, rel);
+    return p;
+}
+
+/* Returns 1 and updates s when path no longer matches s. */
+static int stamp_changed(const char *path, FileStamp *s) {
+    struct stat st;
+    FileStamp cur = {0};
+    if (stat(path, &st) == 0) {
+        cur.dev = st.st_dev;
+        cur.ino = st.st_ino;
+        cur.size = st.st_size;
+        cur.mtim = st.st_mtim;
+        cur.valid = 1;
+    }
+    int changed = cur.valid != s->valid || cur.dev != s->dev || cur.ino != s->ino ||
+                  cur.size != s->size || cur.mtim.tv_sec != s->mtim.tv_sec ||
+                  cur.mtim.tv_nsec != s->mtim.tv_nsec;
+    *s = cur;
+    return changed;
+}
+
+static void stamp_set(const char *path, FileStamp *s) {
+    memset(s, 0, sizeof(*s));
+    stamp_changed(path, s);
+}
+
+/* Reloads the ignore list and quick rules if another process rewrote them. */
+static int repo_refresh(fdiff_repo *repo) {
+    if (stamp_changed(repo->ignore_path, &repo->ignore_stamp)) {
+        IgnoreList fresh;
+        if (ignore_load(repo->ignore_path, repo->root, &fresh) != 0) {
+            set_error(repo, "Failed to load ignore file");
+            return -1;
+        }
+        ignore_free(&repo->ignore);
+        repo->ignore = fresh;
+    }
+    if (stamp_changed(repo->quick_path, &repo->quick_stamp)) {
+        IgnoreList fresh;
+        if (ignore_load(repo->quick_path, repo->root, &fresh) != 0) {
+            set_error(repo, "Failed to load quick rules");
+            return -1;
+        }
+        ignore_free(&repo->quick_rules);
+        repo->quick_rules = fresh;
+    }
+    return 0;
+}
+
+/* Drops the cached index if index.bin changed; returns whether one is cached. */
+static int index_current(fdiff_repo *repo) {
+    if (stamp_changed(repo->index_path, &repo->index_stamp) && repo->index_loaded) {
+        recset_free(&repo->index);
+        repo->index_loaded = 0;
+    }
+    return repo->index_loaded;
+}
+
+static void repo_load_index(fdiff_repo *repo) {
+    if (index_current(repo)) return;
+    RecordSet fresh;
+    repo->index_ok = store_load(repo->index_path, &fresh) == 0;
+    if (repo->index_ok) repo->index = fresh;
+    else recset_init(&repo->index);
+    recset_sort(&repo->index);
+    repo->index_loaded = 1;
+}
+
+int fdiff_open(const char *root, fdiff_repo **out) {
+    fdiff_repo *repo = calloc(1, sizeof(*repo));
+    if (!repo) return FDIFF_FAIL;
+    repo->rootfd = -1;
+    recset_init(&repo->index);
+
+    /* Metadata paths are absolute, so a later chdir() cannot point them at another tree. */
+    repo->root = realpath(root, NULL);
+    if (!repo->root) goto err;
+    repo->index_path = join_path(repo->root, FDIFF_INDEX_FILE);
+    repo->ignore_path = join_path(repo->root, FDIFF_IGNORE_FILE);
+    repo->quick_path = join_path(repo->root, FDIFF_QUICK_FILE);
+    repo->checkpoint_path = join_path(repo->root, CHECKPOINT_FILE);
+    repo->objects_dir = join_path(repo->root, OBJECTS_DIR);
+    if (!repo->index_path || !repo->ignore_path || !repo->quick_path ||
+        !repo->checkpoint_path || !repo->objects_dir) goto err;
+
+    struct stat st;
+    if (stat(repo->index_path, &st) != 0) {
+        errno = ENOENT;
+        goto err;
+    }
+    repo->rootfd = open(repo->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (repo->rootfd < 0) goto err;
+    if (repo_refresh(repo) != 0) goto err;
+    repo->cache = hcache_open_default();
+
+    *out = repo;
+    return FDIFF_OK;
+
+err:
+    {
+        int saved = errno;
+        fdiff_close(repo);
+        errno = saved;
+    }
+    return FDIFF_FAIL;
+}
+
+void fdiff_close(fdiff_repo *repo) {
+    if (!repo) return;
+    if (repo->rootfd >= 0) close(repo->rootfd);
+    hcache_close(repo->cache);
+    ignore_free(&repo->ignore);
+    ignore_free(&repo->quick_rules);
+    recset_free(&repo->index);
+    free(repo->root);
+    free(repo->index_path);
+    free(repo->ignore_path);
+    free(repo->quick_path);
+    free(repo->checkpoint_path);
+    free(repo->objects_dir);
+    free(repo);
+}
+
+/* Snapshots are opt-in: they are taken once .fdiff/objects exists. */
+static int snapshots_enabled(const fdiff_repo *repo) {
+    struct stat st;
+    return stat(repo->objects_dir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void fdiff_set_quick(fdiff_repo *repo, int on) {
+    repo->quick = on;
+}
+
+const char *fdiff_error(const fdiff_repo *repo) {
+    return repo ? repo->err : "";
+}
+
+void fdiff_set_interrupted(int on) {
+    hash_interrupted = on;
+}
+
+
+static int cmp_spec(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_specs(char **specs, size_t n) {
+    for (size_t i = 0; i < n; i++) free(specs[i]);
+    free(specs);
+}
+
+/*
+ * Writes path without "." and empty components, with ".." applied, and
+ * without leading or trailing slashes; out needs strlen(path) + 1 bytes.
+ * Returns -1 when ".." climbs above the start.
+ */
+static int clean_path(const char *path, char *out) {
+    size_t len = 0;
+    for (const char *p = path; *p;) {
+        while (*p == '/') p++;
+        if (!*p) break;
+        const char *e = strchrnul(p, '/');
+        size_t n = (size_t)(e - p);
+        if (n == 2 && p[0] == '.' && p[1] == '.') {
+            if (len == 0) return -1;
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+        } else if (n != 1 || p[0] != '.') {
+            if (len > 0) out[len++] = '/';
+            memcpy(out + len, p, n);
+            len += n;
+        }
+        p = e;
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+/*
+ * Turns path, relative to the root or absolute, into a clean path relative
+ * to the root ("" for the root itself). Returns NULL with errno EXDEV when
+ * it lies outside the tree.
+ */
+static char *root_relative(const fdiff_repo *repo, const char *path) {
+    char *clean = malloc(strlen(path) + 1);
+    if (!clean) return NULL;
+    if (clean_path(path, clean) != 0) goto outside;
+    if (path[0] != '/') return clean;
+
+    /* repo->root is absolute and canonical; compare it without its leading slash. */
+    const char *root = repo->root + 1;
+    size_t root_len = strlen(root);
+    if (root_len == 0) return clean;
+    if (!path_in_spec(clean, root, root_len)) goto outside;
+    size_t skip = clean[root_len] == '/' ? root_len + 1 : root_len;
+    memmove(clean, clean + skip, strlen(clean + skip) + 1);
+    return clean;
+
+outside:
+    free(clean);
+    errno = EXDEV;
+    return NULL;
+}
+
+/*
+ * Turns user paths into sorted, non-overlapping specs relative to the
+ * root. Sets *out_n to 0 when one of them names the whole tree. Paths
+ * outside the tree are an error.
+ */
+static int normalize_specs(fdiff_repo *repo, const char *const *paths, size_t npaths, char ***out, size_t *out_n) {
+    char **specs = calloc(npaths ? npaths : 1, sizeof(char *));
+    if (!specs) {
+        set_error(repo, "Out of memory");
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < npaths; i++) {
+        char *spec = root_relative(repo, paths[i]);
+        if (!spec) {
+            if (errno == EXDEV) set_error(repo, "%s is outside the repository", paths[i]);
+            else set_error(repo, "Out of memory");
+            free_specs(specs, n);
+            return -1;
+        }
+        if (spec[0] == '\0') {
+            free(spec);
+            free_specs(specs, n);
+            *out = NULL;
+            *out_n = 0;
+            return 0;
+        }
+        specs[n++] = spec;
+    }
+    qsort(specs, n, sizeof(char *), cmp_spec);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool covered = false;
+        for (size_t k = 0; k < kept && !covered; k++) covered = path_in_spec(specs[i], specs[k], strlen(specs[k]));
+        if (covered) free(specs[i]);
+        else specs[kept++] = specs[i];
+    }
+    *out = specs;
+    *out_n = kept;
+    return 0;
+}
+
+
+/*
+ * Returns the sorted index records under specs. A scoped run only needs
+ * those: take them from the cached index when it is current, otherwise
+ * read just that slice of index.bin into *slice instead of loading
+ * everything. The caller frees the result only when it is slice.
+ */
+static RecordSet *load_tracked(fdiff_repo *repo, char **specs, size_t nspecs, RecordSet *slice) {
+    RecordSet *set;
+    int rc = 0;
+    if (nspecs == 0) {
+        repo_load_index(repo);
+        rc = repo->index_ok ? 0 : -1;
+        set = &repo->index;
+    } else if (index_current(repo)) {
+        rc = recset_select(&repo->index, (const char *const *)specs, nspecs, slice);
+        set = slice;
+    } else {
+        rc = store_load_paths(repo->index_path, (const char *const *)specs, nspecs, slice);
+        set = slice;
+    }
+    if (rc != 0) {
+        set_error(repo, "Failed to load index.");
+        return NULL;
+    }
+    recset_sort(set);
+    return set;
+}
+
+/*
+ * Quick mode check of a file with a fingerprint: unchanged while size,
+ * mtime and ctime match; modified at once on a new size or sample. Only a
+ * matching sample with disagreeing metadata costs a full hash. Returns 1
+ * when modified.
+ */
+static int quick_status(fdiff_repo *repo, const FileRecord *old, const FileRecord *rec, const char *path) {
+    if (old->size == rec->size && old->mtime == rec->mtime && old->ctime == rec->ctime) return 0;
+    if (old->size != rec->size) return 1;
+    uint64_t q, h;
+    if (compute_quick_fingerprint(repo->rootfd, path, &q) != 0) return -1;
+    if (q != old->quick) return 1;
+    if (compute_file_hash(repo->rootfd, path, &h, NULL, NULL, repo->cache) != 0) return -1;
+    return h != old->hash;
+}
+
+int fdiff_status(fdiff_repo *repo, fdiff_change_fn fn, void *arg) {
+    return fdiff_status_paths(repo, NULL, 0, fn, arg);
+}
+
+int fdiff_status_paths(fdiff_repo *repo, const char *const *paths, size_t npaths, fdiff_change_fn fn, void *arg) {
+    repo->err[0] = '\0';
+    if (repo_refresh(repo) != 0) return FDIFF_FAIL;
+
+    char **specs = NULL;
+    size_t nspecs = 0;
+    if (npaths > 0 && normalize_specs(repo, paths, npaths, &specs, &nspecs) != 0) return FDIFF_FAIL;
+
+    RecordSet slice;
+    RecordSet *old_set = load_tracked(repo, specs, nspecs, &slice);
+    if (!old_set) {
+        free_specs(specs, nspecs);
+        return FDIFF_FAIL;
+    }
+
+    static const char *const whole[1] = { "." };
+    const char *const *starts = nspecs ? (const char *const *)specs : whole;
+    RecordSet new_set;
+    int rc = collect_files(repo->rootfd, starts, nspecs ? (int)nspecs : 1, &repo->ignore, &new_set);
+    free_specs(specs, nspecs);
+    if (rc != 0) {
+        if (old_set == &slice) recset_free(&slice);
+        set_error(repo, "Failed to walk %s", repo->root);
+        return FDIFF_FAIL;
+    }
+
+    recset_sort(&new_set);
+
+    int changed = 0;
+    int stop = 0;
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < new_set.count && !stop; i++) {
+        FileRecord *rec = &new_set.records[i];
+        ssize_t idx = recset_find(old_set, &new_set, rec);
+        if (idx < 0) {
+            recset_path(&new_set, rec, path, sizeof(path));
+            stop = fn(FDIFF_UNTRACKED, path, arg);
+            changed = 1;
+        } else {
+            FileRecord *old = &old_set->records[idx];
+            if (repo->quick && old->quick != 0) {
+                recset_path(&new_set, rec, path, sizeof(path));
+                int q = quick_status(repo, old, rec, path);
+                if (q < 0) {
+                    set_error(repo, "Failed to hash %s", path);
+                    recset_free(&new_set);
+                    if (old_set == &slice) recset_free(&slice);
+                    return FDIFF_FAIL;
+                }
+                if (q) {
+                    stop = fn(FDIFF_MODIFIED, path, arg);
+                    changed = 1;
+                }
+            } else if (old->dev == rec->dev && old->ino == rec->ino) {
+
+            } else if (old->size == rec->size && old->mtime == rec->mtime) {
+
+            } else {
+
+                uint64_t h = 0;
+                recset_path(&new_set, rec, path, sizeof(path));
+                if (rec->size == 0) {
+                    h = 0;
+                } else {
+                    if (compute_file_hash(repo->rootfd, path, &h, NULL, NULL, repo->cache) != 0) {
+                        set_error(repo, "Failed to hash %s", path);
+                        recset_free(&new_set);
+                        if (old_set == &slice) recset_free(&slice);
+                        return FDIFF_FAIL;
+                    }
+                }
+                if (h != old->hash) {
+                    stop = fn(FDIFF_MODIFIED, path, arg);
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+
+    for (size_t i = 0; i < old_set->count && !stop; i++) {
+        ssize_t idx = recset_find(&new_set, old_set, &old_set->records[i]);
+        if (idx == -1) {
+            recset_path(old_set, &old_set->records[i], path, sizeof(path));
+            stop = fn(FDIFF_DELETED, path, arg);
+            changed = 1;
+        }
+    }
+
+    recset_free(&new_set);
+    if (old_set == &slice) recset_free(&slice);
+
+    if (changed) return FDIFF_DIFF_FOUND;
+    return FDIFF_OK;
+}
+
+
+/*
+ * Hashes computed by an unfinished add are periodically appended to
+ * CHECKPOINT_FILE. A later add reuses an entry when the file still has the
+ * same dev, ino, size and mtime, so an interrupted initial run resumes
+ * instead of starting over.
+ *
+ * The file is a log: a magic, then one entry per hashed file (hash, size,
+ * mtime, dev, ino, path length, path). A flush only appends what was hashed
+ * since the previous one, so its cost does not grow with the run. Loading
+ * keeps the last entry for each path and rewrites the log once when it
+ * held duplicates or a torn tail.
+ */
+static const char CHECKPOINT_MAGIC[8] = { 'F', 'D', 'I', 'F', 'F', 'C', 'K', 'P' };
+#define CHECKPOINT_ENTRY_HEADER (5 * sizeof(uint64_t) + sizeof(uint32_t))
+
+typedef struct {
+    const char *path;
+    int fd;            /* log opened for appending, -1 until the first flush */
+    RecordSet resume;  /* loaded from previous runs, sorted */
+    char *pending;     /* entries hashed since the last flush, encoded */
+    size_t pending_len;
+    size_t pending_cap;
+    struct timespec last_flush;
+} Checkpoint;
+
+typedef struct {
+    const char *path;
+    uint32_t len;
+    size_t seq;
+    uint64_t f[5];
+} CheckpointEntry;
+
+static int cmp_checkpoint_entry(const void *pa, const void *pb) {
+    const CheckpointEntry *a = pa, *b = pb;
+    uint32_t n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(a->path, b->path, n);
+    if (c != 0) return c;
+    if (a->len != b->len) return a->len < b->len ? -1 : 1;
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static int checkpoint_append(char **buf, size_t *len, size_t *cap, const char *path, const FileRecord *rec) {
+    size_t plen = strlen(path);
+    size_t need = *len + CHECKPOINT_ENTRY_HEADER + plen;
+    if (need > *cap) {
+        size_t ncap = *cap ? *cap * 2 : 1 << 16;
+        while (ncap < need) ncap *= 2;
+        char *n = realloc(*buf, ncap);
+        if (!n) return -1;
+        *buf = n;
+        *cap = ncap;
+    }
+    const uint64_t f[5] = { rec->hash, rec->size, rec->mtime, rec->dev, rec->ino };
+    uint32_t l = (uint32_t)plen;
+    char *p = *buf + *len;
+    memcpy(p, f, sizeof(f));
+    memcpy(p + sizeof(f), &l, sizeof(l));
+    memcpy(p + CHECKPOINT_ENTRY_HEADER, path, plen);
+    *len = need;
+    return 0;
+}
+
+static int checkpoint_write(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return -1;
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Replaces the log with one entry per path of resume. */
+static int checkpoint_compact(Checkpoint *ck) {
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    char path[PATH_MAX];
+    int rc = -1;
+    for (size_t i = 0; i < ck->resume.count; i++) {
+        const FileRecord *r = &ck->resume.records[i];
+        recset_path(&ck->resume, r, path, sizeof(path));
+        if (checkpoint_append(&buf, &len, &cap, path, r) != 0) goto out;
+    }
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ck->path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) goto out;
+    if (checkpoint_write(fd, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+        checkpoint_write(fd, buf, len) != 0 || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    if (close(fd) != 0 || rename(tmp, ck->path) != 0) {
+        unlink(tmp);
+        goto out;
+    }
+    rc = 0;
+out:
+    free(buf);
+    return rc;
+}
+
+/* Loads the entries of previous runs; a missing or unreadable log just means none. */
+static void checkpoint_load(Checkpoint *ck) {
+    char *data;
+    size_t len;
+    if (objects_read_file(AT_FDCWD, ck->path, SIZE_MAX, &data, &len) != 0) return;
+    if (len < sizeof(CHECKPOINT_MAGIC) || memcmp(data, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        free(data);
+        unlink(ck->path);
+        return;
+    }
+
+    CheckpointEntry *entries = NULL;
+    size_t n = 0, cap = 0;
+    size_t off = sizeof(CHECKPOINT_MAGIC);
+    while (len - off >= CHECKPOINT_ENTRY_HEADER) {
+        CheckpointEntry e;
+        memcpy(e.f, data + off, sizeof(e.f));
+        memcpy(&e.len, data + off + sizeof(e.f), sizeof(e.len));
+        /* A crash mid-append leaves a torn entry at the end. */
+        if (e.len == 0 || e.len >= PATH_MAX || len - off - CHECKPOINT_ENTRY_HEADER < e.len) break;
+        e.path = data + off + CHECKPOINT_ENTRY_HEADER;
+        e.seq = n;
+        if (n == cap) {
+            size_t ncap = cap ? cap * 2 : 1024;
+            CheckpointEntry *ne = realloc(entries, ncap * sizeof(*entries));
+            if (!ne) goto err;
+            entries = ne;
+            cap = ncap;
+        }
+        entries[n++] = e;
+        off += CHECKPOINT_ENTRY_HEADER + e.len;
+    }
+
+    /* Later entries describe a newer state of the same file. */
+    if (n > 0) qsort(entries, n, sizeof(*entries), cmp_checkpoint_entry);
+    char path[PATH_MAX];
+    for (size_t i = 0; i < n; i++) {
+        const CheckpointEntry *e = &entries[i];
+        if (i + 1 < n && e->len == entries[i + 1].len && memcmp(e->path, entries[i + 1].path, e->len) == 0) continue;
+        memcpy(path, e->path, e->len);
+        path[e->len] = '\0';
+        FileRecord *c = recset_add_path(&ck->resume, path);
+        if (!c) goto err;
+        c->hash = e->f[0];
+        c->size = e->f[1];
+        c->mtime = e->f[2];
+        c->dev = e->f[3];
+        c->ino = e->f[4];
+    }
+    recset_sort(&ck->resume);
+    if ((ck->resume.count < n || off != len) && checkpoint_compact(ck) != 0) unlink(ck->path);
+    free(entries);
+    free(data);
+    return;
+
+err:
+    free(entries);
+    free(data);
+    recset_free(&ck->resume);
+    recset_init(&ck->resume);
+}
+
+static void checkpoint_open(Checkpoint *ck, const char *path) {
+    ck->path = path;
+    ck->fd = -1;
+    recset_init(&ck->resume);
+    ck->pending = NULL;
+    ck->pending_len = 0;
+    ck->pending_cap = 0;
+    checkpoint_load(ck);
+    clock_gettime(CLOCK_MONOTONIC, &ck->last_flush);
+}
+
+static int checkpoint_lookup(const Checkpoint *ck, const RecordSet *set, const FileRecord *rec, uint64_t *out_hash) {
+    ssize_t idx = recset_find(&ck->resume, set, rec);
+    if (idx < 0) return -1;
+    const FileRecord *c = &ck->resume.records[idx];
+    if (c->dev != rec->dev || c->ino != rec->ino) return -1;
+    if (c->size != rec->size || c->mtime != rec->mtime) return -1;
+    *out_hash = c->hash;
+    return 0;
+}
+
+static int checkpoint_record(Checkpoint *ck, const char *path, const FileRecord *rec) {
+    return checkpoint_append(&ck->pending, &ck->pending_len, &ck->pending_cap, path, rec);
+}
+
+static int checkpoint_flush(Checkpoint *ck) {
+    if (ck->pending_len == 0) return 0;
+
+    if (ck->fd < 0) {
+        ck->fd = open(ck->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (ck->fd < 0) return -1;
+        struct stat st;
+        if (fstat(ck->fd, &st) != 0) return -1;
+        if (st.st_size == 0 && checkpoint_write(ck->fd, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) return -1;
+    }
+    if (checkpoint_write(ck->fd, ck->pending, ck->pending_len) != 0) return -1;
+    if (fdatasync(ck->fd) != 0) return -1;
+    ck->pending_len = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ck->last_flush);
+    return 0;
+}
+
+static int checkpoint_maybe_flush(Checkpoint *ck) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - ck->last_flush.tv_sec < CHECKPOINT_INTERVAL_SEC) return 0;
+    return checkpoint_flush(ck);
+}
+
+static void checkpoint_close(Checkpoint *ck, bool discard) {
+    if (ck->fd >= 0) close(ck->fd);
+    if (discard) unlink(ck->path);
+    recset_free(&ck->resume);
+    free(ck->pending);
+}
+
+
+/*
+ * Gives rec the sampled fingerprint its quick rules ask for. Same content
+ * means the same samples, so the old fingerprint is kept while the hash is.
+ */
+static int add_quick_record(fdiff_repo *repo, RecordSet *set, FileRecord *rec, const FileRecord *old, char *path, size_t path_size) {
+    rec->quick = 0;
+    if (repo->quick_rules.count == 0 || rec->size == 0) return 0;
+    recset_path(set, rec, path, path_size);
+    if (!ignore_match_path(&repo->quick_rules, path, 0)) return 0;
+    if (old && old->quick != 0 && old->hash == rec->hash) {
+        rec->quick = old->quick;
+        return 0;
+    }
+    return compute_quick_fingerprint(repo->rootfd, path, &rec->quick);
+}
+
+/*
+ * Resolves the hash of rec for add: from the checkpoint when it is still
+ * valid, otherwise by reading the file and remembering the result.
+ */
+static int add_hash_record(fdiff_repo *repo, Checkpoint *ck, RecordSet *set, FileRecord *rec, char *path, size_t path_size) {
+    if (rec->size == 0) {
+        rec->hash = 0;
+        return 0;
+    }
+    if (checkpoint_lookup(ck, set, rec, &rec->hash) == 0) return 0;
+
+    recset_path(set, rec, path, path_size);
+    if (compute_file_hash(repo->rootfd, path, &rec->hash, NULL, NULL, repo->cache) != 0) return -1;
+    if (checkpoint_record(ck, path, rec) != 0) return -1;
+    return checkpoint_maybe_flush(ck);
+}
+
+
+int fdiff_add(fdiff_repo *repo, const char *const *paths, size_t npaths) {
+    repo->err[0] = '\0';
+    if (repo_refresh(repo) != 0) return FDIFF_FAIL;
+    repo_load_index(repo);
+    RecordSet *old_set = &repo->index;
+
+    char **specs = NULL;
+    size_t nspecs = 0;
+    if (npaths > 0 && normalize_specs(repo, paths, npaths, &specs, &nspecs) != 0) return FDIFF_FAIL;
+
+    static const char *const whole[1] = { "." };
+    const char *const *starts = nspecs ? (const char *const *)specs : whole;
+    size_t nstarts = npaths == 0 ? 0 : nspecs ? nspecs : 1;
+    RecordSet new_set;
+    int rc = collect_files(repo->rootfd, starts, (int)nstarts, &repo->ignore, &new_set);
+    free_specs(specs, nspecs);
+    if (rc != 0) {
+        set_error(repo, "Failed to walk %s", repo->root);
+        return FDIFF_FAIL;
+    }
+
+
+    recset_sort(&new_set);
+
+    Checkpoint ck;
+    checkpoint_open(&ck, repo->checkpoint_path);
+
+    int snapshots = snapshots_enabled(repo);
+    int added_count = 0;
+    int ret = FDIFF_OK;
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < new_set.count && !hash_interrupted; i++) {
+        FileRecord *rec = &new_set.records[i];
+        ssize_t idx = recset_find(old_set, &new_set, rec);
+        if (idx < 0) {
+
+            if (add_hash_record(repo, &ck, &new_set, rec, path, sizeof(path)) != 0) {
+                if (hash_interrupted) break;
+                set_error(repo, "Failed to hash %s", path);
+                ret = FDIFF_FAIL;
+                break;
+            }
+            added_count++;
+        } else {
+
+            FileRecord *old = &old_set->records[idx];
+            if (old->dev == rec->dev && old->ino == rec->ino) {
+                rec->hash = old->hash;
+
+            } else if (old->size == rec->size && old->mtime == rec->mtime) {
+                rec->hash = old->hash;
+            } else {
+
+                if (add_hash_record(repo, &ck, &new_set, rec, path, sizeof(path)) != 0) {
+                    if (hash_interrupted) break;
+                    set_error(repo, "Failed to hash %s", path);
+                    ret = FDIFF_FAIL;
+                    break;
+                }
+                if (rec->hash != old->hash) added_count++;
+            }
+        }
+
+        const FileRecord *old = idx >= 0 ? &old_set->records[idx] : NULL;
+        if (add_quick_record(repo, &new_set, rec, old, path, sizeof(path)) != 0) {
+            if (hash_interrupted) break;
+            set_error(repo, "Failed to sample %s", path);
+            ret = FDIFF_FAIL;
+            break;
+        }
+        /* A new fingerprint or quick file ctime is worth saving even if no hash moved. */
+        if (old && (rec->quick != old->quick || (rec->quick != 0 && rec->ctime != old->ctime))) {
+            added_count++;
+        }
+        if (snapshots && rec->size > 0) {
+            recset_path(&new_set, rec, path, sizeof(path));
+            if (objects_store(repo->rootfd, repo->objects_dir, path, rec->hash) < 0) {
+                if (hash_interrupted) break;
+                set_error(repo, "Failed to snapshot %s", path);
+                ret = FDIFF_FAIL;
+                break;
+            }
+        }
+    }
+
+    if (hash_interrupted) ret = FDIFF_INTERRUPTED;
+    if (ret == FDIFF_OK && added_count == 0) ret = FDIFF_ALREADY_ADDED;
+
+    if (ret == FDIFF_OK) {
+
+        if (store_save(repo->index_path, &new_set) != 0) {
+            set_error(repo, "Failed to save index");
+            ret = FDIFF_FAIL;
+        }
+    }
+
+    if (ret == FDIFF_OK || ret == FDIFF_ALREADY_ADDED) {
+        checkpoint_close(&ck, true);
+    } else {
+        /* Keep whatever was hashed so a rerun can pick up from here. */
+        if (checkpoint_flush(&ck) != 0 && ret == FDIFF_INTERRUPTED) {
+            set_error(repo, "Failed to write checkpoint");
+        }
+        checkpoint_close(&ck, false);
+    }
+
+    if (ret == FDIFF_OK) {
+        /* The saved index is the new in-memory one. */
+        recset_free(&repo->index);
+        repo->index = new_set;
+        repo->index_loaded = 1;
+        repo->index_ok = 1;
+        stamp_set(repo->index_path, &repo->index_stamp);
+    } else {
+        recset_free(&new_set);
+    }
+    return ret;
+}
+
+
+/*
+ * A diff takes its file list from status and compares each modified or
+ * deleted file with the snapshot of its indexed content. Files are
+ * diffed by a pool of threads into memory and printed in status order as
+ * soon as everything before them is done.
+ */
+typedef struct {
+    fdiff_change kind;
+    char *path;
+    uint64_t hash;
+    int tracked;
+    char *text;
+    size_t text_len;
+    int failed;
+} DiffJob;
+
+typedef struct {
+    DiffJob *jobs;
+    size_t count;
+    size_t cap;
+    int failed;
+} DiffJobList;
+
+typedef struct {
+    fdiff_repo *repo;
+    DiffJob *jobs;
+    FILE *out;
+    int ret;
+} DiffRun;
+
+static int collect_diff_job(fdiff_change kind, const char *path, void *arg) {
+    DiffJobList *list = arg;
+    if (kind == FDIFF_UNTRACKED) return 0;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        DiffJob *jobs = realloc(list->jobs, cap * sizeof(*jobs));
+        if (!jobs) {
+            list->failed = 1;
+            return 1;
+        }
+        list->jobs = jobs;
+        list->cap = cap;
+    }
+    DiffJob *job = &list->jobs[list->count];
+    memset(job, 0, sizeof(*job));
+    job->kind = kind;
+    job->path = strdup(path);
+    if (!job->path) {
+        list->failed = 1;
+        return 1;
+    }
+    list->count++;
+    return 0;
+}
+
+static void diff_job(void *arg, size_t i) {
+    DiffRun *run = arg;
+    fdiff_repo *repo = run->repo;
+    DiffJob *job = &run->jobs[i];
+    FILE *out = open_memstream(&job->text, &job->text_len);
+    if (!out) {
+        job->failed = 1;
+        return;
+    }
+    char a[PATH_MAX + 2], b[PATH_MAX + 2];
+    snprintf(a, sizeof(a), "a/%s", job->path);
+    if (job->kind == FDIFF_DELETED) strlcpy(b, "/dev/null", sizeof(b));
+    else snprintf(b, sizeof(b), "b/%s", job->path);
+
+    char *old = NULL, *cur = NULL;
+    size_t old_len = 0, cur_len = 0;
+    int rc = 0;
+    if (!job->tracked || objects_load(repo->objects_dir, job->hash, &old, &old_len) != 0) {
+        fprintf(out, "No snapshot of %s\n", job->path);
+    } else if (job->kind == FDIFF_MODIFIED &&
+               (rc = objects_read_file(repo->rootfd, job->path, OBJECTS_MAX_FILE, &cur, &cur_len)) != 0) {
+        /* Snapshots stop at the same size, so this bounds both sides. */
+        if (rc == 1) fprintf(out, "%s is too large to diff\n", job->path);
+        else job->failed = 1;
+    } else if (diff_text(out, a, b, old, old_len, cur ? cur : "", cur_len) != 0) {
+        job->failed = 1;
+    }
+    free(old);
+    free(cur);
+    if (fclose(out) != 0) job->failed = 1;
+}
+
+static void emit_diff(void *arg, size_t i) {
+    DiffRun *run = arg;
+    DiffJob *job = &run->jobs[i];
+    if (job->failed) {
+        if (run->ret != FDIFF_FAIL) set_error(run->repo, "Failed to diff %s", job->path);
+        run->ret = FDIFF_FAIL;
+    } else {
+        fwrite(job->text, 1, job->text_len, run->out);
+    }
+}
+
+/* Fills in the indexed hash of every job from the records under paths. */
+static int resolve_diff_jobs(fdiff_repo *repo, const char *const *paths, size_t npaths, DiffJobList *list) {
+    char **specs = NULL;
+    size_t nspecs = 0;
+    if (npaths > 0 && normalize_specs(repo, paths, npaths, &specs, &nspecs) != 0) return -1;
+    RecordSet slice;
+    RecordSet *tracked = load_tracked(repo, specs, nspecs, &slice);
+    free_specs(specs, nspecs);
+    if (!tracked) return -1;
+
+    char path[PATH_MAX];
+    for (size_t i = 0; i < list->count; i++) {
+        DiffJob *job = &list->jobs[i];
+        size_t idx = recset_lower_bound(tracked, job->path);
+        if (idx >= tracked->count) continue;
+        recset_path(tracked, &tracked->records[idx], path, sizeof(path));
+        if (strcmp(path, job->path) != 0) continue;
+        job->hash = tracked->records[idx].hash;
+        job->tracked = 1;
+    }
+    if (tracked == &slice) recset_free(&slice);
+    return 0;
+}
+
+int fdiff_diff(fdiff_repo *repo, const char *const *paths, size_t npaths, FILE *out) {
+    repo->err[0] = '\0';
+    if (!snapshots_enabled(repo)) {
+        set_error(repo, "Snapshots are not enabled; create %s and run add", OBJECTS_DIR);
+        return FDIFF_FAIL;
+    }
+
+    DiffJobList list;
+    memset(&list, 0, sizeof(list));
+    int ret = fdiff_status_paths(repo, paths, npaths, collect_diff_job, &list);
+    if (ret != FDIFF_FAIL && list.failed) {
+        set_error(repo, "Out of memory");
+        ret = FDIFF_FAIL;
+    }
+    if (ret == FDIFF_FAIL || list.count == 0) goto out;
+    if (resolve_diff_jobs(repo, paths, npaths, &list) != 0) {
+        ret = FDIFF_FAIL;
+        goto out;
+    }
+
+    DiffRun run = { repo, list.jobs, out, ret };
+    pool_run_ordered(list.count, DIFF_MAX_THREADS, diff_job, emit_diff, &run);
+    ret = run.ret;
+    if (ret != FDIFF_FAIL) ret = FDIFF_DIFF_FOUND;
+
+out:
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.jobs[i].path);
+        free(list.jobs[i].text);
+    }
+    free(list.jobs);
+    if (ret == FDIFF_DIFF_FOUND && list.count == 0) ret = FDIFF_OK;
+    return ret;
+}
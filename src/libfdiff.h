@@ -0,0 +1,92 @@
+#ifndef LIBFDIFF_H
+#define LIBFDIFF_H
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * libfdiff: the add/status engine behind the fdiff command, for processes
+ * that check a tree repeatedly. A repo handle keeps the index and the
+ * compiled ignore list in memory and reloads them only when the files on
+ * disk change.
+ */
+
+#define FDIFF_DIR ".fdiff"
+#define FDIFF_INDEX_FILE ".fdiff/index.bin"
+#define FDIFF_IGNORE_FILE ".fdiffignore"
+#define FDIFF_QUICK_FILE ".fdiffquick"
+
+/* Return codes; they double as the fdiff command's exit codes. */
+#define FDIFF_OK 0
+#define FDIFF_FAIL 1
+#define FDIFF_ALREADY_ADDED 6
+#define FDIFF_DIFF_FOUND 7
+#define FDIFF_INTERRUPTED 8
+
+/* The library is built with hidden visibility; only these functions are exported. */
+#define FDIFF_API __attribute__((visibility("default")))
+
+typedef struct fdiff_repo fdiff_repo;
+
+typedef enum {
+    FDIFF_UNTRACKED,
+    FDIFF_MODIFIED,
+    FDIFF_DELETED
+} fdiff_change;
+
+/* Called once per change; return non-zero to stop the status run. */
+typedef int (*fdiff_change_fn)(fdiff_change kind, const char *path, void *arg);
+
+/*
+ * Opens the fdiff repository rooted at root. Fails with errno ENOENT when
+ * root has not been initialized.
+ */
+FDIFF_API int fdiff_open(const char *root, fdiff_repo **out);
+FDIFF_API void fdiff_close(fdiff_repo *repo);
+
+/*
+ * Walks the tree and reports untracked, modified and deleted files to fn.
+ * Returns FDIFF_OK, FDIFF_DIFF_FOUND or FDIFF_FAIL.
+ */
+FDIFF_API int fdiff_status(fdiff_repo *repo, fdiff_change_fn fn, void *arg);
+
+/*
+ * Like fdiff_status, limited to paths (relative to the root) and what lies
+ * below them. Only that part of the tree is walked and only the matching
+ * slice of the index is read.
+ */
+FDIFF_API int fdiff_status_paths(fdiff_repo *repo, const char *const *paths, size_t npaths, fdiff_change_fn fn, void *arg);
+
+/*
+ * Quick mode for later status calls. Files selected by FDIFF_QUICK_FILE
+ * (.fdiffignore syntax) carry a sampled fingerprint, taken by add, next to
+ * their hash. In quick mode such a file is unchanged while its size,
+ * mtime and ctime are; otherwise a differing sample reports it modified
+ * without a full read, and only a matching sample falls back to hashing.
+ */
+FDIFF_API void fdiff_set_quick(fdiff_repo *repo, int on);
+
+/*
+ * Hashes the files under paths (relative to the root) and saves them as
+ * the new index. Returns FDIFF_OK, FDIFF_ALREADY_ADDED when nothing
+ * changed, FDIFF_INTERRUPTED or FDIFF_FAIL.
+ */
+FDIFF_API int fdiff_add(fdiff_repo *repo, const char *const *paths, size_t npaths);
+
+/*
+ * Writes unified diffs of the modified and deleted files under paths
+ * against their snapshots in .fdiff/objects, which add fills once that
+ * directory exists. Files are diffed in parallel. Returns FDIFF_OK,
+ * FDIFF_DIFF_FOUND or FDIFF_FAIL.
+ */
+FDIFF_API int fdiff_diff(fdiff_repo *repo, const char *const *paths, size_t npaths, FILE *out);
+
+/* Message describing the last FDIFF_FAIL, or "" if there is none. */
+FDIFF_API const char *fdiff_error(const fdiff_repo *repo);
+
+/*
+ * Async-signal-safe. While set, a running add stops at the next read and
+ * saves its progress so a later add resumes from there.
+ */
+FDIFF_API void fdiff_set_interrupted(int on);
+
+#endif
@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "objects.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef FDIFF_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hash.h"
+
+/* Content-defined chunk bounds; the cut mask gives an 8 KiB average. */
+#define CHUNK_MIN (2u << 10)
+#define CHUNK_MAX (64u << 10)
+#define CHUNK_MASK ((1u << 13) - 1)
+
+#define MANIFEST_DIR "manifests"
+#define MANIFEST_VERSION 1
+
+#define CHUNK_RAW 0
+#define CHUNK_ZSTD 1
+#define ZSTD_LEVEL 3
+
+static const char MANIFEST_MAGIC[8] = { 'F', 'D', 'I', 'F', 'F', 'O', 'B', 'J' };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nchunks;
+    uint64_t size;
+} ManifestHeader;
+
+typedef struct {
+    unsigned char id[16];
+    uint32_t len;
+} ManifestEntry;
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+/* splitmix64, so every build cuts chunks at the same places. */
+static void gear_init(void) {
+    uint64_t x = 0x6664696666636463ULL;
+    for (int i = 0; i < 256; i++) {
+        x += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+/* Length of the chunk starting at p: the first gear hash cut past CHUNK_MIN. */
+static size_t chunk_len(const unsigned char *p, size_t n) {
+    if (n <= CHUNK_MIN) return n;
+    size_t max = n < CHUNK_MAX ? n : CHUNK_MAX;
+    uint64_t h = 0;
+    for (size_t i = CHUNK_MIN; i < max; i++) {
+        h = (h << 1) + gear[p[i]];
+        if (((h >> 40) & CHUNK_MASK) == 0) return i + 1;
+    }
+    return max;
+}
+
+/*
+ * 128-bit FNV-1a kept as two 64-bit halves, so it builds where __int128
+ * does not. The prime is 2^88 + 0x13b: the low term is a small multiply
+ * with a carry into the high half, and 2^88 shifts lo into hi by 24 bits.
+ */
+static void chunk_id(const unsigned char *p, size_t n, unsigned char id[16]) {
+    const uint64_t prime_lo = 0x13b;
+    uint64_t hi = 0x6c62272e07bb0142ULL, lo = 0x62b821756295c58dULL;
+    for (size_t i = 0; i < n; i++) {
+        lo ^= p[i];
+        uint64_t carry = ((lo >> 32) * prime_lo + (((lo & 0xffffffffULL) * prime_lo) >> 32)) >> 32;
+        hi = hi * prime_lo + carry + (lo << 24);
+        lo *= prime_lo;
+    }
+    for (int i = 0; i < 8; i++) {
+        id[i] = (unsigned char)(hi >> (8 * (7 - i)));
+        id[8 + i] = (unsigned char)(lo >> (8 * (7 - i)));
+    }
+}
+
+static void chunk_path(const char *objects_dir, const unsigned char id[16], char *buf, size_t size, char *sub, size_t sub_size) {
+    char hex[33];
+    for (int i = 0; i < 16; i++) snprintf(hex + 2 * i, 3, "%02x", id[i]);
+    snprintf(sub, sub_size, "%s/%.2s", objects_dir, hex);
+    snprintf(buf, size, "%s/%.2s/%s", objects_dir, hex, hex + 2);
+}
+
+static void manifest_path(const char *objects_dir, uint64_t hash, char *buf, size_t size) {
+    snprintf(buf, size, "%s/" MANIFEST_DIR "/%016llx", objects_dir, (unsigned long long)hash);
+}
+
+
+/* Writes a file under a temporary name and renames it into place. */
+static int write_atomic(const char *dir, const char *path, const void *a, size_t alen, const void *b, size_t blen) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp%ld", path, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    const struct { const void *p; size_t n; } parts[2] = { { a, alen }, { b, blen } };
+    for (int k = 0; k < 2; k++) {
+        const char *p = parts[k].p;
+        size_t left = parts[k].n;
+        while (left > 0) {
+            ssize_t w = write(fd, p, left);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) goto err;
+            p += w;
+            left -= (size_t)w;
+        }
+    }
+    if (close(fd) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    if (rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+
+err:
+    close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+static int store_chunk(const char *objects_dir, const unsigned char *p, size_t n, const unsigned char id[16]) {
+    char path[PATH_MAX], sub[PATH_MAX];
+    chunk_path(objects_dir, id, path, sizeof(path), sub, sizeof(sub));
+    if (access(path, F_OK) == 0) return 0;
+
+    unsigned char method = CHUNK_RAW;
+    const void *data = p;
+    size_t len = n;
+#ifdef FDIFF_WITH_ZSTD
+    size_t bound = ZSTD_compressBound(n);
+    void *z = malloc(bound);
+    if (!z) return -1;
+    size_t zlen = ZSTD_compress(z, bound, p, n, ZSTD_LEVEL);
+    if (!ZSTD_isError(zlen) && zlen < n) {
+        method = CHUNK_ZSTD;
+        data = z;
+        len = zlen;
+    }
+#endif
+    int rc = write_atomic(sub, path, &method, 1, data, len);
+#ifdef FDIFF_WITH_ZSTD
+    free(z);
+#endif
+    return rc;
+}
+
+/* Reads a whole file; *out is malloc'd and NUL-terminated. */
+static int read_all(int fd, size_t size, char **out, size_t *out_len) {
+    char *buf = malloc(size + 1);
+    if (!buf) return -1;
+    size_t have = 0;
+    while (have < size) {
+        if (hash_interrupted) {
+            free(buf);
+            return -1;
+        }
+        ssize_t r = read(fd, buf + have, size - have);
+        if (r < 0 && errno == EINTR && !hash_interrupted) continue;
+        if (r < 0) {
+            free(buf);
+            return -1;
+        }
+        if (r == 0) break;
+        have += (size_t)r;
+    }
+    buf[have] = '\0';
+    *out = buf;
+    *out_len = have;
+    return 0;
+}
+
+int objects_read_file(int dirfd, const char *path, uint64_t max, char **out, size_t *out_len) {
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    int rc = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        rc = (uint64_t)st.st_size > max ? 1 : read_all(fd, (size_t)st.st_size, out, out_len);
+    }
+    close(fd);
+    return rc;
+}
+
+
+int objects_store(int dirfd, const char *objects_dir, const char *path, uint64_t hash) {
+    char mpath[PATH_MAX];
+    manifest_path(objects_dir, hash, mpath, sizeof(mpath));
+    if (access(mpath, F_OK) == 0) return 0;
+
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    if ((uint64_t)st.st_size > OBJECTS_MAX_FILE) {
+        close(fd);
+        return 1;
+    }
+    char *data;
+    size_t len;
+    int rc = read_all(fd, (size_t)st.st_size, &data, &len);
+    close(fd);
+    if (rc != 0) return -1;
+
+    /* The file may have changed since it was hashed; only keep what the index names. */
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= FNV_PRIME;
+    }
+    if (len == 0) h = 0;
+    if (h != hash) {
+        free(data);
+        return 1;
+    }
+
+    pthread_once(&gear_once, gear_init);
+    size_t cap = len / CHUNK_MIN + 1;
+    ManifestEntry *entries = malloc(cap * sizeof(*entries));
+    if (!entries) {
+        free(data);
+        return -1;
+    }
+    uint32_t n = 0;
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t off = 0; off < len;) {
+        size_t c = chunk_len(p + off, len - off);
+        ManifestEntry *e = &entries[n++];
+        memset(e, 0, sizeof(*e));
+        chunk_id(p + off, c, e->id);
+        e->len = (uint32_t)c;
+        if (store_chunk(objects_dir, p + off, c, e->id) != 0) {
+            free(entries);
+            free(data);
+            return -1;
+        }
+        off += c;
+    }
+    free(data);
+
+    /* The manifest goes last, so it only ever names chunks that exist. */
+    ManifestHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MANIFEST_MAGIC, sizeof(hdr.magic));
+    hdr.version = MANIFEST_VERSION;
+    hdr.nchunks = n;
+    hdr.size = len;
+    char mdir[PATH_MAX];
+    snprintf(mdir, sizeof(mdir), "%s/" MANIFEST_DIR, objects_dir);
+    rc = write_atomic(mdir, mpath, &hdr, sizeof(hdr), entries, n * sizeof(*entries));
+    free(entries);
+    return rc;
+}
+
+
+static int load_chunk(const char *objects_dir, const ManifestEntry *e, char *dst) {
+    char path[PATH_MAX], sub[PATH_MAX];
+    chunk_path(objects_dir, e->id, path, sizeof(path), sub, sizeof(sub));
+    char *raw;
+    size_t len;
+    if (objects_read_file(AT_FDCWD, path, CHUNK_MAX + 1, &raw, &len) != 0) return -1;
+
+    int rc = -1;
+    if (len >= 1 && raw[0] == CHUNK_RAW && len - 1 == e->len) {
+        memcpy(dst, raw + 1, e->len);
+        rc = 0;
+    } else if (len >= 1 && raw[0] == CHUNK_ZSTD) {
+#ifdef FDIFF_WITH_ZSTD
+        size_t got = ZSTD_decompress(dst, e->len, raw + 1, len - 1);
+        if (!ZSTD_isError(got) && got == e->len) rc = 0;
+#endif
+    }
+    free(raw);
+    if (rc != 0) return -1;
+
+    unsigned char id[16];
+    chunk_id((const unsigned char *)dst, e->len, id);
+    return memcmp(id, e->id, sizeof(id)) == 0 ? 0 : -1;
+}
+
+int objects_load(const char *objects_dir, uint64_t hash, char **out, size_t *out_len) {
+    if (hash == 0) {
+        /* Empty files are never stored. */
+        *out = calloc(1, 1);
+        *out_len = 0;
+        return *out ? 0 : -1;
+    }
+
+    char mpath[PATH_MAX];
+    manifest_path(objects_dir, hash, mpath, sizeof(mpath));
+    char *m;
+    size_t mlen;
+    if (objects_read_file(AT_FDCWD, mpath, OBJECTS_MAX_FILE, &m, &mlen) != 0) return -1;
+
+    ManifestHeader hdr;
+    if (mlen < sizeof(hdr)) goto err_manifest;
+    memcpy(&hdr, m, sizeof(hdr));
+    if (memcmp(hdr.magic, MANIFEST_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != MANIFEST_VERSION) goto err_manifest;
+    if (mlen != sizeof(hdr) + (size_t)hdr.nchunks * sizeof(ManifestEntry)) goto err_manifest;
+    if (hdr.size > OBJECTS_MAX_FILE) goto err_manifest;
+
+    char *buf = malloc((size_t)hdr.size + 1);
+    if (!buf) goto err_manifest;
+    size_t off = 0;
+    for (uint32_t i = 0; i < hdr.nchunks; i++) {
+        ManifestEntry e;
+        memcpy(&e, m + sizeof(hdr) + i * sizeof(e), sizeof(e));
+        if (e.len > hdr.size - off || load_chunk(objects_dir, &e, buf + off) != 0) {
+            free(buf);
+            goto err_manifest;
+        }
+        off += e.len;
+    }
+    free(m);
+    if (off != hdr.size) {
+        free(buf);
+        return -1;
+    }
+    buf[off] = '\0';
+    *out = buf;
+    *out_len = off;
+    return 0;
+
+err_manifest:
+    free(m);
+    return -1;
+}
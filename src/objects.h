@@ -0,0 +1,34 @@
+#ifndef FDIFF_OBJECTS_H
+#define FDIFF_OBJECTS_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Optional content snapshots under .fdiff/objects, enabled by creating
+ * that directory. Files are cut into content-defined chunks; each chunk is
+ * stored once, named by its 128-bit FNV-1a hash and compressed with zstd
+ * when fdiff is built with it. A manifest named after the file's index
+ * hash lists its chunks, so a tracked version can be rebuilt from the
+ * record alone.
+ */
+#define OBJECTS_DIR ".fdiff/objects"
+#define OBJECTS_MAX_FILE (64ULL << 20)
+
+/*
+ * Snapshots path (relative to dirfd) as the content with the given index
+ * hash. Returns 0 when a snapshot exists afterwards, 1 when the file was
+ * skipped (larger than OBJECTS_MAX_FILE, or it no longer hashes to hash)
+ * and -1 on error.
+ */
+int objects_store(int dirfd, const char *objects_dir, const char *path, uint64_t hash);
+
+/*
+ * Reads a whole file into a malloc'd, NUL-terminated buffer. Returns 1,
+ * reading nothing, when the file is larger than max bytes.
+ */
+int objects_read_file(int dirfd, const char *path, uint64_t max, char **out, size_t *out_len);
+
+/* Rebuilds the content stored for hash into a malloc'd buffer. */
+int objects_load(const char *objects_dir, uint64_t hash, char **out, size_t *out_len);
+
+#endif
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Jobs per thread that may finish ahead of the next one to be emitted. */
+#define POOL_WINDOW_PER_THREAD 4
+
+typedef struct {
+    size_t n;
+    size_t next;
+    size_t emitted;
+    size_t window;
+    unsigned char *done;
+    pool_job_fn job;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Pool;
+
+static void *pool_worker(void *p) {
+    Pool *pool = p;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        /* Held results cost memory; wait while too many are ahead of emit. */
+        while (pool->next < pool->n && pool->next >= pool->emitted + pool->window) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->next >= pool->n) break;
+        size_t i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->job(pool->arg, i);
+        pthread_mutex_lock(&pool->lock);
+        pool->done[i] = 1;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void run_serial(size_t n, pool_job_fn job, pool_job_fn emit, void *arg) {
+    for (size_t i = 0; i < n; i++) {
+        job(arg, i);
+        emit(arg, i);
+    }
+}
+
+void pool_run_ordered(size_t n, size_t max_threads, pool_job_fn job, pool_job_fn emit, void *arg) {
+    if (n == 0) return;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t want = ncpu > 0 ? (size_t)ncpu : 1;
+    if (want > max_threads) want = max_threads;
+    if (want > n) want = n;
+
+    Pool pool;
+    pool.n = n;
+    pool.next = 0;
+    pool.emitted = 0;
+    pool.window = want * POOL_WINDOW_PER_THREAD;
+    pool.done = calloc(n, 1);
+    pool.job = job;
+    pool.arg = arg;
+    pthread_t *threads = malloc(want * sizeof(*threads));
+    if (!pool.done || !threads) {
+        free(pool.done);
+        free(threads);
+        run_serial(n, job, emit, arg);
+        return;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    size_t started = 0;
+    while (started < want && pthread_create(&threads[started], NULL, pool_worker, &pool) == 0) started++;
+    if (started == 0) {
+        run_serial(n, job, emit, arg);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            pthread_mutex_lock(&pool.lock);
+            while (!pool.done[i]) pthread_cond_wait(&pool.cond, &pool.lock);
+            pthread_mutex_unlock(&pool.lock);
+            emit(arg, i);
+            pthread_mutex_lock(&pool.lock);
+            pool.emitted = i + 1;
+            pthread_cond_broadcast(&pool.cond);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+    for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+    free(pool.done);
+}
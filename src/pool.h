@@ -0,0 +1,17 @@
+#ifndef FDIFF_POOL_H
+#define FDIFF_POOL_H
+#include <stddef.h>
+
+typedef void (*pool_job_fn)(void *arg, size_t i);
+
+/*
+ * Runs job(arg, i) for every i below n on up to max_threads threads (no
+ * more than there are CPUs) and calls emit(arg, i) on the calling thread
+ * in index order, each as soon as jobs 0..i have finished. Workers stay
+ * at most a few jobs per thread ahead of emit, so results waiting behind a
+ * slow job take bounded memory. Jobs run on the calling thread when no
+ * thread can be started.
+ */
+void pool_run_ordered(size_t n, size_t max_threads, pool_job_fn job, pool_job_fn emit, void *arg);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #include "store.h"
 #include <stdio.h>
@@ -9,7 +10,39 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <inttypes.h>
+#include <limits.h>
+
+/*
+ * index.bin layout (version 3):
+ *
+ *   magic[8] "FDIFFIDX"
+ *   uint32   version
+ *   uint32   restart interval
+ *   uint64   record count
+ *   uint64   restart count
+ *   uint64   offset of the restart table
+ *   records, sorted by path:
+ *     varint shared   bytes shared with the previous path (0 at restarts)
+ *     varint suffix   length of the remaining bytes
+ *     suffix bytes
+ *     uint64 hash, size, mtime, dev, ino
+ *     varint quick                 sampled fingerprint, 0 if none
+ *     varint ctime                 only when quick is nonzero
+ *   restart table: uint64 offset of every restart record, relative to
+ *   the first record, so a path can be found by binary search without
+ *   decoding the whole file.
+ *
+ * Version 2 records end after ino. Files written before the header existed
+ * start directly with the record count and store every path in full. Both
+ * are still accepted by load.
+ */
+static const char STORE_MAGIC[8] = { 'F', 'D', 'I', 'F', 'F', 'I', 'D', 'X' };
+#define STORE_VERSION 3
+#define STORE_VERSION_NO_QUICK 2
+#define STORE_RESTART_INTERVAL 16
+#define STORE_HEADER_SIZE 40
 
 static int write_all(int fd, const void *buf, size_t count) {
     const unsigned char *p = buf;
@@ -25,93 +58,728 @@ static int write_all(int fd, const void *buf, size_t count) {
     return 0;
 }
 
-int store_save(const char *path, FileRecord *records, size_t count) {
-    
+static size_t next_capacity(size_t cur, size_t need) {
+    size_t nc = cur ? cur : 256;
+    while (nc < need) nc *= 2;
+    return nc;
+}
+
+
+static uint64_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void recset_init(RecordSet *set) {
+    memset(set, 0, sizeof(*set));
+    set->sorted = 1;
+}
+
+void recset_free(RecordSet *set) {
+    if (!set) return;
+    free(set->records);
+    free(set->dirs);
+    free(set->dir_slots);
+    free(set->names);
+    recset_init(set);
+}
+
+static int push_name(RecordSet *set, const char *s, size_t len, uint32_t *out_off) {
+    size_t need = set->names_len + len + 1;
+    if (need > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    if (need > set->names_cap) {
+        size_t nc = next_capacity(set->names_cap, need);
+        char *tmp = realloc(set->names, nc);
+        if (!tmp) return -1;
+        set->names = tmp;
+        set->names_cap = nc;
+    }
+    memcpy(set->names + set->names_len, s, len);
+    set->names[set->names_len + len] = '\0';
+    *out_off = (uint32_t)set->names_len;
+    set->names_len = need;
+    return 0;
+}
+
+static int grow_dir_slots(RecordSet *set) {
+    size_t nc = set->dir_slots_cap ? set->dir_slots_cap * 2 : 64;
+    uint32_t *slots = calloc(nc, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (size_t i = 0; i < set->ndirs; i++) {
+        const char *d = set->names + set->dirs[i];
+        size_t pos = (size_t)hash_bytes(d, strlen(d)) & (nc - 1);
+        while (slots[pos]) pos = (pos + 1) & (nc - 1);
+        slots[pos] = (uint32_t)i + 1;
+    }
+    free(set->dir_slots);
+    set->dir_slots = slots;
+    set->dir_slots_cap = nc;
+    return 0;
+}
+
+int recset_intern_dir(RecordSet *set, const char *dir, size_t len, uint32_t *out_id) {
+    if ((set->ndirs + 1) * 2 > set->dir_slots_cap) {
+        if (grow_dir_slots(set) != 0) return -1;
+    }
+    size_t mask = set->dir_slots_cap - 1;
+    size_t pos = (size_t)hash_bytes(dir, len) & mask;
+    while (set->dir_slots[pos]) {
+        uint32_t id = set->dir_slots[pos] - 1;
+        const char *d = set->names + set->dirs[id];
+        if (strncmp(d, dir, len) == 0 && d[len] == '\0') {
+            *out_id = id;
+            return 0;
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    if (set->ndirs + 1 > set->dirs_cap) {
+        size_t nc = next_capacity(set->dirs_cap, set->ndirs + 1);
+        uint32_t *tmp = realloc(set->dirs, nc * sizeof(uint32_t));
+        if (!tmp) return -1;
+        set->dirs = tmp;
+        set->dirs_cap = nc;
+    }
+    uint32_t off;
+    if (push_name(set, dir, len, &off) != 0) return -1;
+    set->dirs[set->ndirs] = off;
+    set->dir_slots[pos] = (uint32_t)set->ndirs + 1;
+    *out_id = (uint32_t)set->ndirs++;
+    return 0;
+}
+
+FileRecord *recset_append(RecordSet *set, uint32_t dir, const char *name, size_t name_len) {
+    if (set->count + 1 > set->cap) {
+        size_t nc = next_capacity(set->cap, set->count + 1);
+        FileRecord *tmp = realloc(set->records, nc * sizeof(FileRecord));
+        if (!tmp) return NULL;
+        set->records = tmp;
+        set->cap = nc;
+    }
+    uint32_t off;
+    if (push_name(set, name, name_len, &off) != 0) return NULL;
+    FileRecord *r = &set->records[set->count++];
+    memset(r, 0, sizeof(*r));
+    r->dir = dir;
+    r->name = off;
+    set->sorted = 0;
+    return r;
+}
+
+FileRecord *recset_add_path(RecordSet *set, const char *relpath) {
+    const char *slash = strrchr(relpath, '/');
+    size_t dir_len = slash ? (size_t)(slash - relpath) : 0;
+    const char *name = slash ? slash + 1 : relpath;
+
+    /* Consecutive paths almost always share a parent; skip the hash lookup. */
+    uint32_t dir;
+    const FileRecord *last = set->count ? &set->records[set->count - 1] : NULL;
+    const char *last_dir = last ? recset_dir(set, last) : NULL;
+    if (last_dir && strncmp(last_dir, relpath, dir_len) == 0 && last_dir[dir_len] == '\0') {
+        dir = last->dir;
+    } else if (recset_intern_dir(set, relpath, dir_len, &dir) != 0) {
+        return NULL;
+    }
+    return recset_append(set, dir, name, strlen(name));
+}
+
+size_t recset_path(const RecordSet *set, const FileRecord *r, char *buf, size_t size) {
+    const char *dir = recset_dir(set, r);
+    const char *name = recset_name(set, r);
+    size_t dl = strlen(dir), nl = strlen(name);
+    size_t total = dl ? dl + 1 + nl : nl;
+    if (size == 0) return total;
+
+    size_t off = 0;
+    if (dl) {
+        size_t c = dl < size - 1 ? dl : size - 1;
+        memcpy(buf, dir, c);
+        off = c;
+        if (off < size - 1) buf[off++] = '/';
+    }
+    size_t c = nl < size - 1 - off ? nl : size - 1 - off;
+    memcpy(buf + off, name, c);
+    buf[off + c] = '\0';
+    return total;
+}
+
+
+/*
+ * Walks the virtual string dir + "/" + name without materializing it, so
+ * records from different sets (different dir ids) can be compared in full
+ * path order.
+ */
+typedef struct {
+    const char *seg[3];
+    int k;
+    const char *p;
+} PathCursor;
+
+static void cursor_init(PathCursor *c, const char *dir, const char *name) {
+    if (dir[0]) {
+        c->seg[0] = dir;
+        c->seg[1] = "/";
+        c->seg[2] = name;
+    } else {
+        c->seg[0] = name;
+        c->seg[1] = "";
+        c->seg[2] = "";
+    }
+    c->k = 0;
+    c->p = c->seg[0];
+}
+
+static int cursor_next(PathCursor *c) {
+    while (*c->p == '\0') {
+        if (++c->k >= 3) return 0;
+        c->p = c->seg[c->k];
+    }
+    return (unsigned char)*c->p++;
+}
+
+static int cmp_split(const char *da, const char *na, const char *db, const char *nb) {
+    size_t i = 0;
+    while (da[i] && da[i] == db[i]) i++;
+    if (da[i] == db[i]) return strcmp(na, nb);
+    if (da[i] && db[i]) return (unsigned char)da[i] - (unsigned char)db[i];
+
+    /* One directory is a prefix of the other; the separator decides. */
+    PathCursor a, b;
+    cursor_init(&a, da, na);
+    cursor_init(&b, db, nb);
+    for (;;) {
+        int ca = cursor_next(&a);
+        int cb = cursor_next(&b);
+        if (ca != cb) return ca - cb;
+        if (ca == 0) return 0;
+    }
+}
+
+static int cmp_record(const void *a, const void *b, void *arg) {
+    const RecordSet *set = arg;
+    const FileRecord *ra = a;
+    const FileRecord *rb = b;
+    if (ra->dir == rb->dir) return strcmp(recset_name(set, ra), recset_name(set, rb));
+    return cmp_split(recset_dir(set, ra), recset_name(set, ra),
+                     recset_dir(set, rb), recset_name(set, rb));
+}
+
+void recset_sort(RecordSet *set) {
+    if (set->sorted) return;
+    if (set->count > 1) qsort_r(set->records, set->count, sizeof(FileRecord), cmp_record, set);
+    set->sorted = 1;
+}
+
+
+ssize_t recset_find(const RecordSet *set, const RecordSet *other, const FileRecord *rec) {
+    const char *dir = recset_dir(other, rec);
+    const char *name = recset_name(other, rec);
+    size_t lo = 0, hi = set->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const FileRecord *m = &set->records[mid];
+        int c = cmp_split(recset_dir(set, m), recset_name(set, m), dir, name);
+        if (c == 0) return (ssize_t)mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+/* First index whose path is not less than path; set must be sorted. */
+size_t recset_lower_bound(const RecordSet *set, const char *path) {
+    size_t lo = 0, hi = set->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const FileRecord *m = &set->records[mid];
+        if (cmp_split(recset_dir(set, m), recset_name(set, m), "", path) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+
+/* Nonzero when path is spec itself or lies below it. */
+int path_in_spec(const char *path, const char *spec, size_t spec_len) {
+    return strncmp(path, spec, spec_len) == 0 && (path[spec_len] == '\0' || path[spec_len] == '/');
+}
+
+static int copy_record(RecordSet *dst, const char *path, const FileRecord *src) {
+    FileRecord *r = recset_add_path(dst, path);
+    if (!r) return -1;
+    r->hash = src->hash;
+    r->size = src->size;
+    r->mtime = src->mtime;
+    r->dev = src->dev;
+    r->ino = src->ino;
+    r->quick = src->quick;
+    r->ctime = src->ctime;
+    return 0;
+}
+
+int recset_select(const RecordSet *src, const char *const *specs, size_t nspecs, RecordSet *out) {
+    recset_init(out);
+    char path[PATH_MAX];
+    for (size_t s = 0; s < nspecs; s++) {
+        size_t spec_len = strlen(specs[s]);
+        /* Between "a" and "a/..." sort names like "a-b", so start at the spec itself. */
+        for (size_t i = recset_lower_bound(src, specs[s]); i < src->count; i++) {
+            const FileRecord *r = &src->records[i];
+            recset_path(src, r, path, sizeof(path));
+            if (strncmp(path, specs[s], spec_len) != 0) break;
+            if (!path_in_spec(path, specs[s], spec_len)) continue;
+            if (copy_record(out, path, r) != 0) {
+                recset_free(out);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+typedef struct {
+    int fd;
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    uint64_t written;
+} Writer;
+
+static int writer_flush(Writer *w) {
+    if (w->len == 0) return 0;
+    if (write_all(w->fd, w->buf, w->len) != 0) return -1;
+    w->len = 0;
+    return 0;
+}
+
+static int writer_put(Writer *w, const void *p, size_t n) {
+    if (w->len + n > w->cap) {
+        if (writer_flush(w) != 0) return -1;
+        if (n > w->cap) {
+            if (write_all(w->fd, p, n) != 0) return -1;
+            w->written += n;
+            return 0;
+        }
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+    w->written += n;
+    return 0;
+}
+
+static int writer_u64(Writer *w, uint64_t v) {
+    return writer_put(w, &v, sizeof(v));
+}
+
+static int writer_varint(Writer *w, uint64_t v) {
+    unsigned char tmp[10];
+    size_t n = 0;
+    do {
+        unsigned char b = v & 0x7f;
+        v >>= 7;
+        if (v) b |= 0x80;
+        tmp[n++] = b;
+    } while (v);
+    return writer_put(w, tmp, n);
+}
+
+int store_save(const char *path, RecordSet *set) {
+
     char tmp[4096];
     snprintf(tmp, sizeof(tmp), "%s.tmp", path);
     int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (fd < 0) return -1;
 
-    uint64_t cc = (uint64_t)count;
-    if (write_all(fd, &cc, sizeof(uint64_t)) != 0) goto err;
+    recset_sort(set);
+
+    Writer w = { .fd = fd, .cap = 1 << 16 };
+    w.buf = malloc(w.cap);
+    uint64_t nrestarts = (set->count + STORE_RESTART_INTERVAL - 1) / STORE_RESTART_INTERVAL;
+    uint64_t *restarts = calloc(nrestarts ? nrestarts : 1, sizeof(uint64_t));
+    char *prev = NULL, *cur = NULL;
+    size_t prev_len = 0, path_cap = 0;
+    if (!w.buf || !restarts) goto err;
+
+    unsigned char hdr[STORE_HEADER_SIZE] = {0};
+    if (writer_put(&w, hdr, sizeof(hdr)) != 0) goto err;
+    uint64_t base = w.written;
+
+    for (size_t i = 0; i < set->count; i++) {
+        const FileRecord *r = &set->records[i];
+        size_t len = recset_path(set, r, NULL, 0);
+        if (len + 1 > path_cap) {
+            path_cap = next_capacity(path_cap, len + 1);
+            char *a = realloc(prev, path_cap);
+            if (!a) goto err;
+            prev = a;
+            char *b = realloc(cur, path_cap);
+            if (!b) goto err;
+            cur = b;
+        }
+        recset_path(set, r, cur, len + 1);
 
-    for (size_t i = 0; i < count; i++) {
-        uint64_t path_len = (uint64_t)strlen(records[i].path);
-        if (write_all(fd, &path_len, sizeof(uint64_t)) != 0) goto err;
-        if (write_all(fd, records[i].path, path_len) != 0) goto err;
-        if (write_all(fd, &records[i].hash, sizeof(uint64_t)) != 0) goto err;
-        if (write_all(fd, &records[i].size, sizeof(uint64_t)) != 0) goto err;
-        if (write_all(fd, &records[i].mtime, sizeof(uint64_t)) != 0) goto err;
-        if (write_all(fd, &records[i].dev, sizeof(uint64_t)) != 0) goto err;
-        if (write_all(fd, &records[i].ino, sizeof(uint64_t)) != 0) goto err;
+        size_t shared = 0;
+        if (i % STORE_RESTART_INTERVAL == 0) {
+            restarts[i / STORE_RESTART_INTERVAL] = w.written - base;
+        } else {
+            size_t max = prev_len < len ? prev_len : len;
+            while (shared < max && prev[shared] == cur[shared]) shared++;
+        }
+        if (writer_varint(&w, shared) != 0) goto err;
+        if (writer_varint(&w, len - shared) != 0) goto err;
+        if (writer_put(&w, cur + shared, len - shared) != 0) goto err;
+        if (writer_u64(&w, r->hash) != 0) goto err;
+        if (writer_u64(&w, r->size) != 0) goto err;
+        if (writer_u64(&w, r->mtime) != 0) goto err;
+        if (writer_u64(&w, r->dev) != 0) goto err;
+        if (writer_u64(&w, r->ino) != 0) goto err;
+        if (writer_varint(&w, r->quick) != 0) goto err;
+        if (r->quick != 0 && writer_varint(&w, r->ctime) != 0) goto err;
+
+        char *t = prev;
+        prev = cur;
+        cur = t;
+        prev_len = len;
     }
 
-    if (fsync(fd) != 0) goto err;
+    uint64_t restart_off = w.written;
+    for (uint64_t i = 0; i < nrestarts; i++) {
+        if (writer_u64(&w, restarts[i]) != 0) goto err;
+    }
+    if (writer_flush(&w) != 0) goto err;
+
+    memcpy(hdr, STORE_MAGIC, sizeof(STORE_MAGIC));
+    uint32_t version = STORE_VERSION, interval = STORE_RESTART_INTERVAL;
+    uint64_t cc = (uint64_t)set->count;
+    memcpy(hdr + 8, &version, sizeof(version));
+    memcpy(hdr + 12, &interval, sizeof(interval));
+    memcpy(hdr + 16, &cc, sizeof(cc));
+    memcpy(hdr + 24, &nrestarts, sizeof(nrestarts));
+    memcpy(hdr + 32, &restart_off, sizeof(restart_off));
+    if (pwrite(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) goto err;
+
+    free(prev);
+    free(cur);
+    free(restarts);
+    free(w.buf);
+
+    if (fsync(fd) != 0) goto err_closed;
     if (close(fd) != 0) return -1;
 
     if (rename(tmp, path) != 0) return -1;
     return 0;
 
 err:
+    free(prev);
+    free(cur);
+    free(restarts);
+    free(w.buf);
+err_closed:
     close(fd);
     unlink(tmp);
     return -1;
 }
 
-int store_load(const char *path, FileRecord **records, size_t *count) {
-    FILE *f = fopen(path, "rb");
-    if (!f) return -1;
 
-    uint64_t rec_count;
-    if (fread(&rec_count, sizeof(uint64_t), 1, f) != 1) {
-        fclose(f);
+static int read_file(const char *path, unsigned char **out, size_t *out_len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
         return -1;
     }
-
-    FileRecord *recs = calloc((size_t)rec_count, sizeof(FileRecord));
-    if (!recs) {
-        fclose(f);
+    size_t len = (size_t)st.st_size;
+    unsigned char *buf = malloc(len ? len : 1);
+    if (!buf) {
+        close(fd);
         return -1;
     }
+    size_t off = 0;
+    while (off < len) {
+        ssize_t r = read(fd, buf + off, len - off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            close(fd);
+            return -1;
+        }
+        if (r == 0) break;
+        off += (size_t)r;
+    }
+    close(fd);
+    *out = buf;
+    *out_len = off;
+    return 0;
+}
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} Reader;
+
+static int reader_u64(Reader *r, uint64_t *v) {
+    if ((size_t)(r->end - r->p) < sizeof(uint64_t)) return -1;
+    memcpy(v, r->p, sizeof(uint64_t));
+    r->p += sizeof(uint64_t);
+    return 0;
+}
+
+static int reader_varint(Reader *r, uint64_t *v) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p >= r->end) return -1;
+        unsigned char b = *r->p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 0;
+        }
+    }
+    return -1;
+}
 
+static int reader_fields(Reader *r, uint32_t version, FileRecord *rec) {
+    if (reader_u64(r, &rec->hash) != 0) return -1;
+    if (reader_u64(r, &rec->size) != 0) return -1;
+    if (reader_u64(r, &rec->mtime) != 0) return -1;
+    if (reader_u64(r, &rec->dev) != 0) return -1;
+    if (reader_u64(r, &rec->ino) != 0) return -1;
+    if (version == STORE_VERSION_NO_QUICK) return 0;
+    if (reader_varint(r, &rec->quick) != 0) return -1;
+    if (rec->quick != 0 && reader_varint(r, &rec->ctime) != 0) return -1;
+    return 0;
+}
+
+static int load_legacy(Reader *r, RecordSet *set) {
+    uint64_t rec_count;
+    if (reader_u64(r, &rec_count) != 0) return -1;
+
+    char *path = NULL;
+    size_t path_cap = 0;
     for (uint64_t i = 0; i < rec_count; i++) {
         uint64_t path_len;
-        if (fread(&path_len, sizeof(uint64_t), 1, f) != 1) goto err;
-        char *buf = malloc((size_t)path_len + 1);
-        if (!buf) goto err;
-        if (fread(buf, 1, (size_t)path_len, f) != path_len) {
-            free(buf);
-            goto err;
+        if (reader_u64(r, &path_len) != 0) goto err;
+        if (path_len > (uint64_t)(r->end - r->p)) goto err;
+        if (path_len + 1 > path_cap) {
+            path_cap = next_capacity(path_cap, (size_t)path_len + 1);
+            char *tmp = realloc(path, path_cap);
+            if (!tmp) goto err;
+            path = tmp;
         }
-        buf[path_len] = '\0';
-        recs[i].path = buf;
+        memcpy(path, r->p, (size_t)path_len);
+        path[path_len] = '\0';
+        r->p += path_len;
 
-        if (fread(&recs[i].hash, sizeof(uint64_t), 1, f) != 1) goto err;
-        if (fread(&recs[i].size, sizeof(uint64_t), 1, f) != 1) goto err;
-        if (fread(&recs[i].mtime, sizeof(uint64_t), 1, f) != 1) goto err;
-        if (fread(&recs[i].dev, sizeof(uint64_t), 1, f) != 1) goto err;
-        if (fread(&recs[i].ino, sizeof(uint64_t), 1, f) != 1) goto err;
+        FileRecord *rec = recset_add_path(set, path);
+        if (!rec) goto err;
+        if (reader_fields(r, STORE_VERSION_NO_QUICK, rec) != 0) goto err;
     }
-
-    fclose(f);
-    *records = recs;
-    *count = (size_t)rec_count;
+    free(path);
     return 0;
 
 err:
-    for (uint64_t j = 0; j < rec_count; j++) {
-        free(recs[j].path);
+    free(path);
+    return -1;
+}
+
+/* Reassembles front-coded paths; len is the length of the previous path. */
+typedef struct {
+    char *path;
+    size_t cap;
+    size_t len;
+} PathDecoder;
+
+static int decode_path(Reader *r, PathDecoder *d) {
+    uint64_t shared, suffix;
+    if (reader_varint(r, &shared) != 0) return -1;
+    if (reader_varint(r, &suffix) != 0) return -1;
+    if (shared > d->len) return -1;
+    if (suffix > (uint64_t)(r->end - r->p)) return -1;
+    size_t len = (size_t)(shared + suffix);
+    if (len + 1 > d->cap) {
+        size_t nc = next_capacity(d->cap, len + 1);
+        char *tmp = realloc(d->path, nc);
+        if (!tmp) return -1;
+        d->path = tmp;
+        d->cap = nc;
     }
-    free(recs);
-    fclose(f);
+    memcpy(d->path + shared, r->p, (size_t)suffix);
+    d->path[len] = '\0';
+    r->p += suffix;
+    d->len = len;
+    return 0;
+}
+
+typedef struct {
+    uint32_t version;
+    uint32_t interval;
+    uint64_t count;
+    uint64_t nrestarts;
+    uint64_t restart_off;
+} StoreHeader;
+
+static int read_header(Reader *r, StoreHeader *h) {
+    if ((size_t)(r->end - r->p) < STORE_HEADER_SIZE) return -1;
+    memcpy(&h->version, r->p + 8, sizeof(h->version));
+    memcpy(&h->interval, r->p + 12, sizeof(h->interval));
+    memcpy(&h->count, r->p + 16, sizeof(h->count));
+    memcpy(&h->nrestarts, r->p + 24, sizeof(h->nrestarts));
+    memcpy(&h->restart_off, r->p + 32, sizeof(h->restart_off));
+    if (h->version != STORE_VERSION && h->version != STORE_VERSION_NO_QUICK) return -1;
+    r->p += STORE_HEADER_SIZE;
+    return 0;
+}
+
+static int load_indexed(Reader *r, RecordSet *set) {
+    StoreHeader h;
+    if (read_header(r, &h) != 0) return -1;
+
+    PathDecoder d = {0};
+    for (uint64_t i = 0; i < h.count; i++) {
+        if (decode_path(r, &d) != 0) goto err;
+        FileRecord *rec = recset_add_path(set, d.path);
+        if (!rec) goto err;
+        if (reader_fields(r, h.version, rec) != 0) goto err;
+    }
+    free(d.path);
+    set->sorted = 1;
+    return 0;
+
+err:
+    free(d.path);
     return -1;
 }
 
-void store_free(FileRecord *records, size_t count) {
-    if (!records) return;
-    for (size_t i = 0; i < count; i++) {
-        free(records[i].path);
+int store_load(const char *path, RecordSet *set) {
+    unsigned char *buf;
+    size_t len;
+    recset_init(set);
+    if (read_file(path, &buf, &len) != 0) return -1;
+
+    Reader r = { buf, buf + len };
+    int rc;
+    if (len >= sizeof(STORE_MAGIC) && memcmp(buf, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0) {
+        rc = load_indexed(&r, set);
+    } else {
+        rc = load_legacy(&r, set);
+    }
+    free(buf);
+    if (rc != 0) {
+        recset_free(set);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Decodes the full path stored at a restart record. */
+static int restart_path(const unsigned char *base, const unsigned char *end, uint64_t off, PathDecoder *d) {
+    if (off >= (uint64_t)(end - base)) return -1;
+    Reader r = { base + off, end };
+    d->len = 0;
+    return decode_path(&r, d);
+}
+
+/*
+ * Appends the records of one spec from a mapped index. The
+ * restart table narrows the search to a single block before decoding.
+ */
+static int load_spec(const unsigned char *base, const unsigned char *end, const uint64_t *restarts,
+                     const StoreHeader *h, const char *spec, RecordSet *set) {
+    PathDecoder d = {0};
+    size_t lo = 0, hi = (size_t)h->nrestarts;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (restart_path(base, end, restarts[mid], &d) != 0) goto err;
+        if (strcmp(d.path, spec) < 0) lo = mid + 1;
+        else hi = mid;
     }
-    free(records);
+    size_t block = lo ? lo - 1 : 0;
+    if (block >= h->nrestarts) {
+        free(d.path);
+        return 0;
+    }
+
+    size_t spec_len = strlen(spec);
+    Reader r = { base + restarts[block], end };
+    d.len = 0;
+    for (uint64_t i = (uint64_t)block * h->interval; i < h->count; i++) {
+        if (decode_path(&r, &d) != 0) goto err;
+        int c = strncmp(d.path, spec, spec_len);
+        if (c > 0) break;
+        if (c < 0 || !path_in_spec(d.path, spec, spec_len)) {
+            FileRecord skip;
+            if (reader_fields(&r, h->version, &skip) != 0) goto err;
+            continue;
+        }
+        FileRecord *rec = recset_add_path(set, d.path);
+        if (!rec) goto err;
+        if (reader_fields(&r, h->version, rec) != 0) goto err;
+    }
+    free(d.path);
+    return 0;
+
+err:
+    free(d.path);
+    return -1;
 }
 
+int store_load_paths(const char *path, const char *const *specs, size_t nspecs, RecordSet *set) {
+    recset_init(set);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = len >= STORE_HEADER_SIZE ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (map == MAP_FAILED || memcmp(map, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) {
+        /* Old layout (or tiny file): no restart table, so filter a full load. */
+        if (map != MAP_FAILED) munmap(map, len);
+        RecordSet all;
+        if (store_load(path, &all) != 0) return -1;
+        recset_sort(&all);
+        int rc = recset_select(&all, specs, nspecs, set);
+        recset_free(&all);
+        return rc;
+    }
+
+    const unsigned char *p = map;
+    Reader r = { p, p + len };
+    StoreHeader h;
+    if (read_header(&r, &h) != 0 || h.interval == 0 ||
+        h.restart_off > len || h.nrestarts > (len - h.restart_off) / sizeof(uint64_t)) {
+        munmap(map, len);
+        return -1;
+    }
+    const unsigned char *base = r.p;
+    const unsigned char *end = p + h.restart_off;
+    uint64_t *restarts = malloc((size_t)(h.nrestarts ? h.nrestarts : 1) * sizeof(uint64_t));
+    if (!restarts) {
+        munmap(map, len);
+        return -1;
+    }
+    memcpy(restarts, end, (size_t)h.nrestarts * sizeof(uint64_t));
+
+    int rc = 0;
+    for (size_t s = 0; s < nspecs && rc == 0; s++) {
+        rc = load_spec(base, end, restarts, &h, specs[s], set);
+    }
+    free(restarts);
+    munmap(map, len);
+    if (rc != 0) recset_free(set);
+    return rc;
+}
@@ -2,19 +2,74 @@
 #define FDIFF_STORE_H
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
+/*
+ * A record does not own its path. The directory part is interned once per
+ * RecordSet (dir) and the basename lives in the set's name arena (name), so
+ * siblings share a single copy of their parent path.
+ */
 typedef struct {
-    char *path;      
-    uint64_t hash;   
+    uint32_t dir;    /* index into RecordSet.dirs */
+    uint32_t name;   /* offset of the basename in RecordSet.names */
+    uint64_t hash;
     uint64_t size;
     uint64_t mtime;
     uint64_t dev;
     uint64_t ino;
+    uint64_t quick;  /* sampled fingerprint for quick checks, 0 = none */
+    uint64_t ctime;  /* kept on disk only alongside quick */
 } FileRecord;
 
-int store_load(const char *path, FileRecord **records, size_t *count);
-int store_save(const char *path, FileRecord *records, size_t count);
-void store_free(FileRecord *records, size_t count);
+typedef struct {
+    FileRecord *records;
+    size_t count;
+    size_t cap;
 
-#endif
+    uint32_t *dirs;      /* offsets into names; "" is the top level */
+    size_t ndirs;
+    size_t dirs_cap;
+    uint32_t *dir_slots; /* open addressing table over dirs, 0 = empty */
+    size_t dir_slots_cap;
+
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+
+    int sorted;
+} RecordSet;
+
+void recset_init(RecordSet *set);
+void recset_free(RecordSet *set);
+int recset_intern_dir(RecordSet *set, const char *dir, size_t len, uint32_t *out_id);
+FileRecord *recset_append(RecordSet *set, uint32_t dir, const char *name, size_t name_len);
+FileRecord *recset_add_path(RecordSet *set, const char *relpath);
+void recset_sort(RecordSet *set);
+ssize_t recset_find(const RecordSet *set, const RecordSet *other, const FileRecord *rec);
+size_t recset_lower_bound(const RecordSet *set, const char *path);
+
+static inline const char *recset_dir(const RecordSet *set, const FileRecord *r) {
+    return set->names + set->dirs[r->dir];
+}
 
+static inline const char *recset_name(const RecordSet *set, const FileRecord *r) {
+    return set->names + r->name;
+}
+
+/* Writes the full relative path of r into buf, strlcpy style. */
+size_t recset_path(const RecordSet *set, const FileRecord *r, char *buf, size_t size);
+
+/*
+ * A spec selects a path and everything below it ("conf" matches "conf" and
+ * "conf/app.ini", not "conf-old"). Specs must not overlap.
+ */
+int recset_select(const RecordSet *src, const char *const *specs, size_t nspecs, RecordSet *out);
+
+/* Nonzero when path is the spec of length spec_len itself or lies below it. */
+int path_in_spec(const char *path, const char *spec, size_t spec_len);
+
+int store_load(const char *path, RecordSet *set);
+int store_load_paths(const char *path, const char *const *specs, size_t nspecs, RecordSet *set);
+int store_save(const char *path, RecordSet *set);
+
+#endif
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "walk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <bsd/string.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <sys/sysmacros.h>
+#endif
+
+static size_t next_capacity(size_t cur) {
+    if (cur == 0) return 256;
+    return cur * 2;
+}
+
+
+static char *normalize_relpath(const char *p) {
+    if (!p) return NULL;
+    
+    size_t L = strlen(p);
+    char *buf = malloc(L + 2);
+    if (!buf) return NULL;
+    strlcpy(buf, p, L+2);
+    
+    if (buf[0] == '.' && buf[1] == '/') {
+        memmove(buf, buf + 2, strlen(buf + 2) + 1);
+    }
+    
+    if (strlen(buf) > 1 && buf[strlen(buf)-1] == '/') {
+        buf[strlen(buf)-1] = '\0';
+    }
+    return buf;
+}
+
+
+static int push_dir(char ***stack, size_t *count, size_t *cap, char *dir) {
+    if (*count + 1 > *cap) {
+        size_t nc = next_capacity(*cap);
+        char **tmp = realloc(*stack, nc * sizeof(char *));
+        if (!tmp) return -1;
+        *stack = tmp; *cap = nc;
+    }
+    (*stack)[(*count)++] = dir;
+    return 0;
+}
+
+
+static void fill_record(FileRecord *r, const struct stat *st) {
+    r->hash = 0;
+    r->size = (uint64_t)st->st_size;
+    r->mtime = (uint64_t)st->st_mtime;
+    r->dev = (uint64_t)st->st_dev;
+    r->ino = (uint64_t)st->st_ino;
+    r->ctime = (uint64_t)st->st_ctime;
+}
+
+
+/*
+ * Directory enumeration. On Linux entries come straight from getdents64
+ * into one large buffer shared by the whole walk, instead of libc's small
+ * per-DIR buffer; elsewhere this wraps readdir.
+ */
+#define DIRENT_BUF_SZ (256 * 1024)
+
+typedef struct {
+    int fd;
+    dev_t dev;
+#ifdef __linux__
+    char *buf;
+    size_t len;
+    size_t pos;
+#else
+    DIR *dir;
+#endif
+} DirReader;
+
+#ifdef __linux__
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static int dir_open(DirReader *dr, int rootfd, const char *path, char *buf) {
+    dr->fd = openat(rootfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dr->fd < 0) return -1;
+    struct stat st;
+    if (fstat(dr->fd, &st) != 0) {
+        close(dr->fd);
+        return -1;
+    }
+    dr->dev = st.st_dev;
+#ifdef __linux__
+    dr->buf = buf;
+    dr->len = 0;
+    dr->pos = 0;
+#else
+    (void)buf;
+    dr->dir = fdopendir(dr->fd);
+    if (!dr->dir) {
+        close(dr->fd);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/* Returns 1 with the next entry, 0 at the end, -1 on error. */
+static int dir_next(DirReader *dr, const char **name, unsigned char *type) {
+#ifdef __linux__
+    if (dr->pos >= dr->len) {
+        long n = syscall(SYS_getdents64, dr->fd, dr->buf, DIRENT_BUF_SZ);
+        if (n <= 0) return n == 0 ? 0 : -1;
+        dr->len = (size_t)n;
+        dr->pos = 0;
+    }
+    struct linux_dirent64 *de = (struct linux_dirent64 *)(dr->buf + dr->pos);
+    dr->pos += de->d_reclen;
+    *name = de->d_name;
+    *type = de->d_type;
+    return 1;
+#else
+    struct dirent *de = readdir(dr->dir);
+    if (!de) return 0;
+    *name = de->d_name;
+#ifdef DT_UNKNOWN
+    *type = de->d_type;
+#else
+    *type = 0;
+#endif
+    return 1;
+#endif
+}
+
+static void dir_close(DirReader *dr) {
+#ifdef __linux__
+    close(dr->fd);
+#else
+    closedir(dr->dir);
+#endif
+}
+
+
+/*
+ * Stats name inside dirfd. statx is asked only for what a record needs, and
+ * on network filesystems told not to revalidate attributes with the server.
+ */
+static int stat_entry(int dirfd, const char *name, int dont_sync, struct stat *st) {
+#if defined(__linux__) && defined(STATX_TYPE)
+    struct statx sx;
+    int flags = AT_SYMLINK_NOFOLLOW | (dont_sync ? AT_STATX_DONT_SYNC : 0);
+    unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO;
+    if (statx(dirfd, name, flags, mask, &sx) == 0) {
+        memset(st, 0, sizeof(*st));
+        st->st_mode = sx.stx_mode;
+        st->st_size = (off_t)sx.stx_size;
+        st->st_mtime = (time_t)sx.stx_mtime.tv_sec;
+        st->st_ctime = (time_t)sx.stx_ctime.tv_sec;
+        st->st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+        st->st_ino = (ino_t)sx.stx_ino;
+        return 0;
+    }
+    if (errno != ENOSYS) return -1;
+#else
+    (void)dont_sync;
+#endif
+    return fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+}
+
+static int is_network_fs(int fd) {
+#ifdef __linux__
+    struct statfs sf;
+    if (fstatfs(fd, &sf) != 0) return 0;
+    switch ((unsigned long)sf.f_type) {
+    case 0x6969:      /* NFS */
+    case 0xff534d42:  /* CIFS */
+    case 0xfe534d42:  /* SMB2 */
+    case 0x517b:      /* SMB */
+    case 0x65735546:  /* FUSE */
+    case 0x01021997:  /* 9P */
+    case 0x00c36400:  /* Ceph */
+        return 1;
+    default:
+        return 0;
+    }
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+
+int collect_files(int rootfd, const char *const *start_paths, int nstart, const IgnoreList *ignore, RecordSet *out) {
+    RecordSet set;
+    recset_init(&set);
+
+    
+    char **stack = NULL;
+    size_t stack_count = 0, stack_cap = 0;
+    char *dirent_buf = NULL;
+    char *child = NULL;
+
+    for (int i = 0; i < nstart; i++) {
+        char *norm = normalize_relpath(start_paths[i]);
+        if (!norm) goto err;
+        struct stat st;
+        if (fstatat(rootfd, start_paths[i], &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            
+            free(norm);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            
+            int is_ig = ignore_match(ignore, norm, 1);
+            if (!is_ig) {
+                
+                if (push_dir(&stack, &stack_count, &stack_cap, norm) != 0) { free(norm); goto err; }
+            } else {
+                free(norm);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            int is_ig = ignore_match(ignore, norm, 0);
+            if (!is_ig) {
+                FileRecord *r = recset_add_path(&set, norm);
+                if (!r) { free(norm); goto err; }
+                fill_record(r, &st);
+            }
+            free(norm);
+        } else {
+            free(norm);
+        }
+    }
+
+    
+    dirent_buf = malloc(DIRENT_BUF_SZ);
+    size_t child_cap = PATH_MAX;
+    child = malloc(child_cap);
+    if (!dirent_buf || !child) goto err;
+    /* A mount point below the root can be a different kind of filesystem. */
+    dev_t fs_dev = 0;
+    int fs_known = 0, dont_sync = 0;
+
+    while (stack_count > 0) {
+        char *dirpath = stack[--stack_count];
+        DirReader dr;
+        if (dir_open(&dr, rootfd, dirpath, dirent_buf) != 0) {
+            free(dirpath);
+            continue;
+        }
+        if (!fs_known || dr.dev != fs_dev) {
+            fs_dev = dr.dev;
+            fs_known = 1;
+            dont_sync = is_network_fs(dr.fd);
+        }
+
+        /* Every entry of this directory shares one interned parent path. */
+        const char *prefix = strcmp(dirpath, ".") == 0 ? "" : dirpath;
+        size_t prefix_len = strlen(prefix);
+        uint32_t dir_id;
+        if (recset_intern_dir(&set, prefix, prefix_len, &dir_id) != 0) {
+            dir_close(&dr);
+            free(dirpath);
+            goto err;
+        }
+
+        const char *name;
+        unsigned char type;
+        while (dir_next(&dr, &name, &type) == 1) {
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            
+            size_t name_len = strlen(name);
+            size_t need = prefix_len + 1 + name_len + 1;
+            if (need > child_cap) {
+                char *tmp = realloc(child, need);
+                if (!tmp) { dir_close(&dr); free(dirpath); goto err; }
+                child = tmp; child_cap = need;
+            }
+            child[0] = '\0';
+            strlcpy(child, prefix, need);
+            if (child[0] != '\0') {
+                strlcat(child, "/", need);
+            }
+            strlcat(child, name, need);
+
+            /*
+             * d_type settles directories and special files on its own; a
+             * stat is only needed for files that survive the ignore list
+             * or when the filesystem does not report a type.
+             */
+            struct stat st;
+            int is_dir, is_reg, have_stat = 0;
+            if (type == DT_DIR || type == DT_REG) {
+                is_dir = type == DT_DIR;
+                is_reg = type == DT_REG;
+            } else if (type != DT_UNKNOWN) {
+                continue;
+            } else {
+                if (stat_entry(dr.fd, name, dont_sync, &st) < 0) continue;
+                is_dir = S_ISDIR(st.st_mode);
+                is_reg = S_ISREG(st.st_mode);
+                have_stat = 1;
+                if (!is_dir && !is_reg) continue;
+            }
+
+            if (ignore_match(ignore, child, is_dir)) {
+                continue;
+            }
+
+            if (is_dir) {
+                
+                char *sub = strdup(child);
+                if (!sub || push_dir(&stack, &stack_count, &stack_cap, sub) != 0) {
+                    free(sub); dir_close(&dr); free(dirpath); goto err;
+                }
+            } else if (is_reg) {
+                if (!have_stat && stat_entry(dr.fd, name, dont_sync, &st) < 0) continue;
+                /* Replaced by something else since getdents. */
+                if (!S_ISREG(st.st_mode)) continue;
+                FileRecord *r = recset_append(&set, dir_id, name, name_len);
+                if (!r) { dir_close(&dr); free(dirpath); goto err; }
+                fill_record(r, &st);
+            }
+        }
+        dir_close(&dr);
+        free(dirpath);
+    }
+
+    free(child);
+    free(dirent_buf);
+    free(stack);
+    *out = set;
+    return 0;
+
+err:
+    free(child);
+    free(dirent_buf);
+    recset_free(&set);
+    if (stack) {
+        for (size_t i = 0; i < stack_count; i++) free(stack[i]);
+        free(stack);
+    }
+    return -1;
+}
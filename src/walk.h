@@ -0,0 +1,12 @@
+#ifndef FDIFF_WALK_H
+#define FDIFF_WALK_H
+#include "ignore.h"
+#include "store.h"
+
+/*
+ * Collects the regular files under start_paths, which are relative to the
+ * directory rootfd, skipping anything ignore matches. Hashes are left at 0.
+ */
+int collect_files(int rootfd, const char *const *start_paths, int nstart, const IgnoreList *ignore, RecordSet *out);
+
+#endif